@@ -0,0 +1,530 @@
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "../my_vm.h"
+
+// Benchmark suite for spotting regressions between releases. Every case
+// prints one JSON line with its operations per second, p50 and p99
+// latency in ns and the TLB miss rate over the run. Latencies come from
+// the t_vm_stats() histograms of the operation a case is made of, or are
+// timed per operation here for mat_mult() and trace replay.
+//
+//   bench_suite [--quick] [workload...]   run some workloads, all by default:
+//                                         alloc access matmul threads churn
+//   bench_suite replay FILE               replay a trace file
+//   bench_suite record FILE               write the suite's synthetic trace
+//   bench_suite compare OLD NEW           compare two result files and
+//                                         exit 1 if a case got slower
+//
+// All inputs come from fixed seeds, so runs differ only in timing.
+//
+// Trace files start with TRACE_MAGIC, followed by one record per
+// operation: an op byte, then LEB128 numbers. TRACE_MALLOC id size,
+// TRACE_FREE id, TRACE_PUT id offset length and TRACE_GET id offset
+// length. An id below MAX_TRACE_IDS names a live allocation and may be
+// reused once it is freed. Offsets and lengths stay inside the allocation.
+// replay rejects a trace breaking any of this, or ending mid-record.
+// Programs record their own calls in this format with t_record_start().
+
+#define TRACE_MAGIC "VMTRACE1"
+#define TRACE_MALLOC 1
+#define TRACE_FREE 2
+#define TRACE_PUT 3
+#define TRACE_GET 4
+#define MAX_TRACE_IDS (1 << 20)
+
+#define MAX_THREADS 16
+#define MAX_SAMPLES (1 << 20)
+#define REGRESSION 0.9 // slowest ops/sec ratio that compare still accepts
+
+bool quick;
+struct vm_stats *before, *after;
+double *samples; // per operation latencies of cases timed here
+unsigned long sample_count;
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Iterations scaled down for --quick
+long scaled(long n) {
+    return quick ? (n + 9) / 10 : n;
+}
+
+void begin_case() {
+    sample_count = 0;
+    t_vm_stats(before);
+}
+
+// Keeps the latency of one operation timed here
+void add_sample(double ns) {
+    if (sample_count < MAX_SAMPLES)
+        samples[sample_count++] = ns;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+Prints the JSON line of a case that did ops operations in seconds. The
+latencies are those of op in the histograms, or the samples taken here
+when op is VM_OPS.
+*/
+void report(const char *bench, const char *name, enum vm_op op, double ops, double seconds) {
+    double p50 = 0, p99 = 0;
+    t_vm_stats(after);
+    if (op < VM_OPS) {
+        struct vm_histogram *hist = &after->latency[op];
+        hist->count -= before->latency[op].count;
+        for (int b = 0; b < VM_HIST_BUCKETS; b++)
+            hist->buckets[b] -= before->latency[op].buckets[b];
+        p50 = t_vm_percentile(hist, 50);
+        p99 = t_vm_percentile(hist, 99);
+    } else if (sample_count > 0) {
+        qsort(samples, sample_count, sizeof(double), compare_doubles);
+        p50 = samples[(sample_count - 1) / 2];
+        p99 = samples[(sample_count - 1) * 99 / 100];
+    }
+    unsigned long hits = after->tlb_hits - before->tlb_hits;
+    unsigned long misses = after->tlb_misses - before->tlb_misses;
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%.0f,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"tlb_miss_rate\":%.6f}\n",
+           bench, name, ops, seconds, ops / seconds, p50, p99,
+           hits + misses == 0 ? 0.0 : (double)misses / (hits + misses));
+    fflush(stdout);
+}
+
+// t_malloc() and t_free() pairs for request sizes from a slab object to 16 MiB
+void bench_alloc() {
+    static const unsigned int sizes[] = {64, 1024, 4096, 65536, 1 << 20, 16 << 20};
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        long rounds = scaled(sizes[s] >= (1 << 20) ? 2000 : 200000);
+        char name[32];
+        snprintf(name, sizeof(name), "malloc_free_%u", sizes[s]);
+        begin_case();
+        double start = now_ns();
+        for (long i = 0; i < rounds; i++)
+            t_free(t_malloc(sizes[s]), sizes[s]);
+        report("alloc", name, VM_OP_MALLOC, rounds, (now_ns() - start) / 1e9);
+    }
+}
+
+/*
+put_value() and get_value() of 8 bytes over a 64 MiB buffer of small
+pages, so the TLB is in play: in order, a page and a word apart, and at
+random words.
+*/
+void bench_access() {
+    static const char *patterns[] = {"sequential", "strided", "random"};
+    unsigned long size = 64UL << 20, words = size / 8;
+    long ops = scaled(4000000);
+    set_large_pages(false);
+    char *buf = t_malloc(size);
+    set_large_pages(true);
+    for (unsigned long off = 0; off < size; off += PGSIZE)
+        put_value(buf + off, &off, 8);
+
+    for (int p = 0; p < 3; p++) {
+        for (int write = 1; write >= 0; write--) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s_%s", patterns[p], write ? "put" : "get");
+            unsigned long seed = 12345, word = 0, val = 0;
+            begin_case();
+            double start = now_ns();
+            for (long i = 0; i < ops; i++) {
+                if (p == 0) {
+                    word = (word + 1) % words;
+                } else if (p == 1) {
+                    word = (word + PGSIZE / 8 + 1) % words;
+                } else {
+                    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                    word = (seed >> 16) % words;
+                }
+                if (write)
+                    put_value(buf + word * 8, &i, 8);
+                else
+                    get_value(buf + word * 8, &val, 8);
+            }
+            report("access", name, write ? VM_OP_PUT : VM_OP_GET, ops, (now_ns() - start) / 1e9);
+        }
+    }
+    t_free(buf, size);
+}
+
+// mat_mult() of 256 x 256 matrices on 1 to 8 threads
+void bench_matmul() {
+    int size = 256, rounds = quick ? 2 : 10;
+    unsigned long bytes = (unsigned long)size * size * sizeof(int);
+    char *a = t_malloc(bytes), *b = t_malloc(bytes), *c = t_malloc(bytes);
+    int *row = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++)
+            row[j] = (i * 7 + j * 3) % 11;
+        put_value(a + (unsigned long)i * size * sizeof(int), row, size * sizeof(int));
+        put_value(b + (unsigned long)i * size * sizeof(int), row, size * sizeof(int));
+    }
+
+    for (int n = 1; n <= 8; n *= 2) {
+        char name[32];
+        snprintf(name, sizeof(name), "mat_mult_256_t%d", n);
+        set_mat_threads(n);
+        mat_mult(a, b, size, c); // start the pool
+        begin_case();
+        double start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            double op_start = now_ns();
+            mat_mult(a, b, size, c);
+            add_sample(now_ns() - op_start);
+        }
+        report("matmul", name, VM_OPS, rounds, (now_ns() - start) / 1e9);
+    }
+    set_mat_threads(1);
+    free(row);
+    t_free(a, bytes);
+    t_free(b, bytes);
+    t_free(c, bytes);
+}
+
+long thread_rounds;
+
+// Allocates, writes, reads back and frees a few pages at a time
+void *contend(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg + 1;
+    for (long r = 0; r < thread_rounds; r++) {
+        unsigned int size = (1 + rand_r(&seed) % 8) * PGSIZE;
+        char *va = t_malloc(size);
+        for (unsigned int off = 0; off < size; off += PGSIZE) {
+            unsigned long val;
+            put_value(va + off, &r, sizeof(r));
+            get_value(va + off, &val, sizeof(val));
+            if (val != (unsigned long)r) {
+                printf("thread %ld read %lu, expected %ld\n", (long)arg, val, r);
+                exit(1);
+            }
+        }
+        t_free(va, size);
+    }
+    return NULL;
+}
+
+// The allocate, write, read and free loop on 1 to MAX_THREADS threads at once
+void bench_threads() {
+    pthread_t threads[MAX_THREADS];
+    thread_rounds = scaled(20000);
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        char name[32];
+        snprintf(name, sizeof(name), "alloc_rw_free_t%d", n);
+        begin_case();
+        double start = now_ns();
+        for (long i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, contend, (void *)i);
+        for (int i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        report("threads", name, VM_OP_MALLOC, (double)n * thread_rounds, (now_ns() - start) / 1e9);
+    }
+}
+
+/*
+Fragmentation churn: 256 live allocations of 1 to 256 pages, a random one
+replaced at every step. Also prints the frames and page table pages still
+in use once they are all freed, which should not grow between releases.
+*/
+void bench_churn() {
+    enum { SLOTS = 256 };
+    char *live[SLOTS] = {0};
+    unsigned int sizes[SLOTS] = {0};
+    unsigned int seed = 1;
+    long steps = scaled(200000);
+    struct paging_stats paging;
+
+    get_paging_stats(&paging);
+    unsigned long base = paging.resident;
+    begin_case();
+    double start = now_ns();
+    for (long i = 0; i < steps; i++) {
+        int s = rand_r(&seed) % SLOTS;
+        if (live[s] != NULL)
+            t_free(live[s], sizes[s]);
+        sizes[s] = (1 + rand_r(&seed) % 256) * PGSIZE;
+        live[s] = t_malloc(sizes[s]);
+        put_value(live[s] + sizes[s] - sizeof(i), &i, sizeof(i));
+    }
+    report("churn", "replace_1_256_pages", VM_OP_FREE, steps, (now_ns() - start) / 1e9);
+    for (int s = 0; s < SLOTS; s++)
+        if (live[s] != NULL)
+            t_free(live[s], sizes[s]);
+    get_paging_stats(&paging);
+    t_vm_stats(after);
+    printf("{\"bench\":\"churn\",\"case\":\"left_after_free\",\"frames\":%ld,\"table_pages\":%lu}\n",
+           (long)(paging.resident - base), after->table_pages);
+}
+
+// One decoded trace record
+struct trace_op {
+    unsigned char op;
+    unsigned long id, a, b;
+};
+
+void put_number(FILE *f, unsigned long n) {
+    do {
+        fputc((n & 0x7f) | (n >= 0x80 ? 0x80 : 0), f);
+        n >>= 7;
+    } while (n != 0);
+}
+
+// Decodes a number into n; false if the data ends inside it or it overflows
+bool get_number(const unsigned char **p, const unsigned char *end, unsigned long *n) {
+    *n = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        *n |= (unsigned long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return shift < 63 || byte <= 1;
+    }
+    return false;
+}
+
+// Checks one decoded record against the allocations live before it
+const char *check_record(const struct trace_op *t, const unsigned long *sizes) {
+    if (t->id >= MAX_TRACE_IDS)
+        return "id out of range";
+    if (t->op == TRACE_MALLOC && sizes[t->id] != 0)
+        return "id already live";
+    if (t->op == TRACE_MALLOC)
+        return t->a == 0 || t->a > INT_MAX ? "bad size" : NULL; // t_free() takes an int
+    if (sizes[t->id] == 0)
+        return "id not live";
+    if (t->op != TRACE_FREE && (t->b > INT_MAX || t->a > sizes[t->id] || t->b > sizes[t->id] - t->a))
+        return "access outside the allocation";
+    return NULL;
+}
+
+/*
+Writes the synthetic trace: 64 allocation slots of 256 bytes to 1 MiB,
+each filled in order when allocated, then read and written in runs at
+random offsets, and replaced now and then.
+*/
+int record_trace(const char *path) {
+    enum { SLOTS = 64 };
+    unsigned int sizes[SLOTS] = {0};
+    unsigned int seed = 7;
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), f);
+    for (int i = 0; i < 200000; i++) {
+        int s = rand_r(&seed) % SLOTS;
+        if (sizes[s] == 0 || rand_r(&seed) % 50 == 0) {
+            if (sizes[s] != 0) {
+                fputc(TRACE_FREE, f);
+                put_number(f, s);
+            }
+            sizes[s] = 256 << (rand_r(&seed) % 13);
+            fputc(TRACE_MALLOC, f);
+            put_number(f, s);
+            put_number(f, sizes[s]);
+            for (unsigned int off = 0; off < sizes[s]; off += PGSIZE) {
+                fputc(TRACE_PUT, f);
+                put_number(f, s);
+                put_number(f, off);
+                put_number(f, sizes[s] - off < 64 ? sizes[s] - off : 64);
+            }
+            continue;
+        }
+        unsigned int len = 8 << (rand_r(&seed) % 6);
+        if (len > sizes[s])
+            len = sizes[s];
+        fputc(rand_r(&seed) % 3 == 0 ? TRACE_PUT : TRACE_GET, f);
+        put_number(f, s);
+        put_number(f, rand_r(&seed) % (sizes[s] - len + 1));
+        put_number(f, len);
+    }
+    for (int s = 0; s < SLOTS; s++) {
+        if (sizes[s] != 0) {
+            fputc(TRACE_FREE, f);
+            put_number(f, s);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+Replays a trace file, read, decoded and checked before the clock starts,
+and reports every operation in it as one, with its latency timed here.
+Returns 1 without replaying anything if a record is broken or does not
+fit the allocations live before it.
+*/
+int replay_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc(length > 0 ? length : 1);
+    if (length < (long)strlen(TRACE_MAGIC) || fread(data, 1, length, f) != (size_t)length ||
+        memcmp(data, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+        printf("%s is not a trace file\n", path);
+        fclose(f);
+        free(data);
+        return 1;
+    }
+    fclose(f);
+
+    // decode and check, sizing the id table and the copy buffer on the way
+    const unsigned char *p = data + strlen(TRACE_MAGIC), *end = data + length;
+    struct trace_op *ops = malloc(length * sizeof(struct trace_op));
+    unsigned long *sizes = calloc(MAX_TRACE_IDS, sizeof(unsigned long));
+    unsigned long count = 0, ids = 0, longest = 1;
+    while (p < end) {
+        struct trace_op *t = &ops[count++];
+        t->op = *p++;
+        t->a = t->b = 0;
+        const char *error;
+        if (t->op < TRACE_MALLOC || t->op > TRACE_GET)
+            error = "unknown op";
+        else if (!get_number(&p, end, &t->id) || (t->op != TRACE_FREE && !get_number(&p, end, &t->a)) ||
+                 (t->op >= TRACE_PUT && !get_number(&p, end, &t->b)))
+            error = "truncated";
+        else
+            error = check_record(t, sizes);
+        if (error != NULL) {
+            printf("bad record %lu in %s: %s\n", count - 1, path, error);
+            free(data);
+            free(ops);
+            free(sizes);
+            return 1;
+        }
+        if (t->op == TRACE_MALLOC)
+            sizes[t->id] = t->a;
+        else if (t->op == TRACE_FREE)
+            sizes[t->id] = 0;
+        if (t->id >= ids)
+            ids = t->id + 1;
+        if (t->op >= TRACE_PUT && t->b > longest)
+            longest = t->b;
+    }
+    memset(sizes, 0, ids * sizeof(unsigned long));
+    char **live = calloc(ids, sizeof(char *));
+    char *buf = calloc(longest, 1);
+
+    begin_case();
+    double start = now_ns();
+    for (unsigned long i = 0; i < count; i++) {
+        struct trace_op *t = &ops[i];
+        double op_start = now_ns();
+        switch (t->op) {
+        case TRACE_MALLOC:
+            live[t->id] = t_malloc(t->a);
+            sizes[t->id] = t->a;
+            break;
+        case TRACE_FREE:
+            t_free(live[t->id], sizes[t->id]);
+            live[t->id] = NULL;
+            break;
+        case TRACE_PUT:
+            put_value(live[t->id] + t->a, buf, t->b);
+            break;
+        case TRACE_GET:
+            get_value(live[t->id] + t->a, buf, t->b);
+            break;
+        }
+        add_sample(now_ns() - op_start);
+    }
+    report("replay", path, VM_OPS, count, (now_ns() - start) / 1e9);
+    for (unsigned long id = 0; id < ids; id++)
+        if (live[id] != NULL)
+            t_free(live[id], sizes[id]);
+    free(live);
+    free(sizes);
+    free(buf);
+    free(ops);
+    free(data);
+    return 0;
+}
+
+// Reads the bench, case and ops_per_sec of a result line; false for other lines
+bool parse_result(const char *line, char *key, double *ops_per_sec) {
+    char bench[64], name[192];
+    const char *rate = strstr(line, "\"ops_per_sec\":");
+    if (sscanf(line, "{\"bench\":\"%63[^\"]\",\"case\":\"%191[^\"]\"", bench, name) != 2 || rate == NULL)
+        return false;
+    snprintf(key, 256, "%s/%s", bench, name);
+    *ops_per_sec = atof(rate + strlen("\"ops_per_sec\":"));
+    return true;
+}
+
+/*
+Prints the ops/sec ratio of every case in both result files, flagging
+those that fell below REGRESSION times the old rate. Returns 1 if any did.
+*/
+int compare_results(const char *old_path, const char *new_path) {
+    FILE *old_file = fopen(old_path, "r"), *new_file = fopen(new_path, "r");
+    if (old_file == NULL || new_file == NULL) {
+        perror(old_file == NULL ? old_path : new_path);
+        return 2;
+    }
+    char line[1024], key[256], old_key[256];
+    double rate, old_rate;
+    int slower = 0;
+    printf("%-44s %14s %14s %7s\n", "case", "old ops/s", "new ops/s", "ratio");
+    while (fgets(line, sizeof(line), new_file) != NULL) {
+        if (!parse_result(line, key, &rate))
+            continue;
+        bool found = false;
+        rewind(old_file);
+        while (!found && fgets(line, sizeof(line), old_file) != NULL)
+            found = parse_result(line, old_key, &old_rate) && strcmp(key, old_key) == 0;
+        if (!found)
+            continue;
+        bool regressed = rate < old_rate * REGRESSION;
+        printf("%-44s %14.1f %14.1f %7.3f%s\n", key, old_rate, rate, rate / old_rate, regressed ? "  SLOWER" : "");
+        slower |= regressed;
+    }
+    fclose(old_file);
+    fclose(new_file);
+    return slower;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "record") == 0)
+        return record_trace(argv[2]);
+    if (argc == 4 && strcmp(argv[1], "compare") == 0)
+        return compare_results(argv[2], argv[3]);
+
+    before = malloc(sizeof(struct vm_stats));
+    after = malloc(sizeof(struct vm_stats));
+    samples = malloc(MAX_SAMPLES * sizeof(double));
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the timings
+
+    if (argc == 3 && strcmp(argv[1], "replay") == 0)
+        return replay_trace(argv[2]);
+
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--quick") == 0) {
+        quick = true;
+        first = 2;
+    }
+    static const char *names[] = {"alloc", "access", "matmul", "threads", "churn"};
+    static void (*const runs[])() = {bench_alloc, bench_access, bench_matmul, bench_threads, bench_churn};
+    for (int w = 0; w < 5; w++) {
+        bool wanted = first == argc;
+        for (int i = first; i < argc; i++)
+            wanted |= strcmp(argv[i], names[w]) == 0;
+        if (wanted)
+            runs[w]();
+    }
+    free(before);
+    free(after);
+    free(samples);
+    return 0;
+}
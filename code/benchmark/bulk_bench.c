@@ -0,0 +1,61 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Measures put_value/get_value bandwidth for transfers from one page up to
+// 64 MiB, next to a plain memcpy of the same size. Each transfer starts at
+// an unaligned offset so the head and tail pages are partial.
+
+#define MAX_TRANSFER (64 * 1024 * 1024)
+#define OFFSET 100
+
+char *src, *dst;
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double gbps(unsigned long bytes, double ns, int reps) {
+    return (double)bytes * reps / ns;
+}
+
+int main() {
+    src = malloc(MAX_TRANSFER);
+    dst = malloc(MAX_TRANSFER);
+    for (unsigned long i = 0; i < MAX_TRANSFER; i++)
+        src[i] = (char)(i * 31 + 7);
+    memset(dst, 0, MAX_TRANSFER); // fault the destination in before timing
+
+    printf("%10s %12s %12s %12s\n", "bytes", "put GB/s", "get GB/s", "memcpy GB/s");
+    for (unsigned long size = PGSIZE; size <= MAX_TRANSFER; size *= 4) {
+        int reps = (int)(256UL * 1024 * 1024 / size);
+        char *va = t_malloc(size + OFFSET);
+        put_value(va + OFFSET, src, size); // fault the frames in before timing
+
+        double start = now_ns();
+        for (int r = 0; r < reps; r++)
+            put_value(va + OFFSET, src, size);
+        double put_ns = now_ns() - start;
+
+        start = now_ns();
+        for (int r = 0; r < reps; r++)
+            get_value(va + OFFSET, dst, size);
+        double get_ns = now_ns() - start;
+
+        if (memcmp(src, dst, size) != 0) {
+            printf("data mismatch at %lu bytes\n", size);
+            return 1;
+        }
+
+        start = now_ns();
+        for (int r = 0; r < reps; r++)
+            memcpy(dst, src, size);
+        double copy_ns = now_ns() - start;
+
+        printf("%10lu %12.2f %12.2f %12.2f\n", size, gbps(size, put_ns, reps), gbps(size, get_ns, reps),
+               gbps(size, copy_ns, reps));
+        t_free(va, size + OFFSET);
+    }
+    return 0;
+}
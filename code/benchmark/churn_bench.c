@@ -0,0 +1,85 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Long running allocation churn: SLOTS live allocations of 1 to MAX_PAGES
+// pages, one page in each written, with a random one freed and replaced
+// at every step. Once per interval prints the steps per second, the frames
+// in use and the resident set size of the process, which stay flat when
+// t_free() hands back frames and empty page tables alike. The resident set
+// still grows for the first seconds, until frame allocation has gone round
+// every frame once and touched all of the per-frame tables. Runs for the
+// number of seconds given as the argument, 20 by default.
+
+#define SLOTS 256
+#define MAX_PAGES 256
+#define INTERVAL_NS 1e9
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double rss_mib() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident * 4096.0 / (1024 * 1024);
+}
+
+unsigned long resident() {
+    struct paging_stats stats;
+    get_paging_stats(&stats);
+    return stats.resident;
+}
+
+char *slot_va[SLOTS];
+unsigned int slot_size[SLOTS];
+
+// Replaces slot i with a fresh allocation, checking the old one first
+void churn(int i, unsigned int *seed) {
+    unsigned long word;
+    if (slot_va[i] != NULL) {
+        get_value(slot_va[i] + slot_size[i] - sizeof(word), &word, sizeof(word));
+        if (word != (unsigned long)i) {
+            printf("slot %d lost its contents\n", i);
+            exit(1);
+        }
+        t_free(slot_va[i], slot_size[i]);
+    }
+    slot_size[i] = (1 + rand_r(seed) % MAX_PAGES) * PGSIZE;
+    slot_va[i] = t_malloc(slot_size[i]);
+    word = i;
+    put_value(slot_va[i] + slot_size[i] - sizeof(word), &word, sizeof(word));
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 20;
+    unsigned int seed = 1;
+    set_large_pages(false);
+
+    for (int i = 0; i < SLOTS; i++)
+        churn(i, &seed);
+    printf("%d live allocations of 1 to %d pages\n", SLOTS, MAX_PAGES);
+    printf("%4s %12s %10s %10s\n", "s", "steps/s", "frames", "RSS MiB");
+
+    for (int s = 1; s <= seconds; s++) {
+        double start = now_ns();
+        unsigned long steps = 0;
+        while (now_ns() - start < INTERVAL_NS) {
+            for (int n = 0; n < 64; n++)
+                churn(rand_r(&seed) % SLOTS, &seed);
+            steps += 64;
+        }
+        printf("%4d %12.0f %10lu %10.1f\n", s, steps * 1e9 / (now_ns() - start), resident(), rss_mib());
+    }
+
+    for (int i = 0; i < SLOTS; i++)
+        t_free(slot_va[i], slot_size[i]);
+    printf("after freeing all: %lu frames, %.1f MiB RSS\n", resident(), rss_mib());
+    return 0;
+}
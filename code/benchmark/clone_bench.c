@@ -0,0 +1,78 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Warms up a 256 MiB dataset, then times t_clone() of the address space
+// holding it, with large pages and with small ones, next to copying the
+// dataset out and back in with get_value()/put_value(). The clone then
+// writes one word on every 16th page, which copies those pages, and is
+// torn down with t_destroy().
+
+#define DATASET (256 * 1024 * 1024)
+#define PAGES (DATASET / PGSIZE)
+#define WRITE_EVERY 16
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void run(bool large, const char *label, char *copy) {
+    set_large_pages(large);
+    char *data = t_malloc(DATASET);
+    for (unsigned long p = 0; p < PAGES; p++)
+        put_value(data + p * PGSIZE, &p, sizeof(unsigned long));
+
+    double start = now_ns();
+    int space = t_clone();
+    double clone_ns = now_ns() - start;
+    if (space < 0) {
+        printf("t_clone failed\n");
+        exit(1);
+    }
+
+    t_switch(space);
+    start = now_ns();
+    for (unsigned long p = 0; p < PAGES; p += WRITE_EVERY) {
+        unsigned long val = ~p;
+        put_value(data + p * PGSIZE, &val, sizeof(unsigned long));
+    }
+    double write_ns = now_ns() - start;
+    t_switch(0);
+
+    // the original keeps its values
+    for (unsigned long p = 0; p < PAGES; p += WRITE_EVERY) {
+        unsigned long val;
+        get_value(data + p * PGSIZE, &val, sizeof(unsigned long));
+        if (val != p) {
+            printf("page %lu changed in the original\n", p);
+            exit(1);
+        }
+    }
+
+    start = now_ns();
+    t_destroy(space);
+    double destroy_ns = now_ns() - start;
+
+    start = now_ns();
+    get_value(data, copy, DATASET);
+    put_value(data, copy, DATASET);
+    double copy_ns = now_ns() - start;
+
+    printf("%-6s %10.1f %14.2f %12.1f %10.1f\n", label, clone_ns / 1e3,
+           write_ns / (PAGES / WRITE_EVERY) / 1e3, destroy_ns / 1e3, copy_ns / 1e3);
+    t_free(data, DATASET);
+}
+
+int main() {
+    char *copy = malloc(DATASET);
+    memset(copy, 0, DATASET);
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the timings
+
+    printf("%d MiB dataset, a write to every %dth page of the clone\n", DATASET >> 20, WRITE_EVERY);
+    printf("%-6s %10s %14s %12s %10s\n", "pages", "clone us", "us/first write", "destroy us", "copy us");
+    run(true, "large", copy);
+    run(false, "small", copy);
+    free(copy);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Physical contiguity of buffers and fragmentation of free frames.
+// First BUFFERS buffers of BUF_SIZE are written a page of each at a time,
+// the way threads filling their own buffers interleave, and the spans
+// t_pin() finds in each and the bandwidth of copying each out with one
+// get_value() are printed. Then SLOTS buffers of 1 to MAX_PAGES pages are
+// freed and reallocated at random for ROUNDS steps, printing every
+// INTERVAL steps the pages per span of the live buffers, the copy
+// bandwidth of a fresh buffer and the layout of free physical memory.
+
+#define BUFFERS 4
+#define BUF_SIZE (16 * 1024 * 1024)
+#define SLOTS 64
+#define MAX_PAGES 1024
+#define ROUNDS 4000
+#define INTERVAL 500
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct t_iovec spans[BUF_SIZE / PGSIZE + 2];
+char *copy;
+
+int count_spans(char *va, unsigned long size) {
+    int count = t_pin(va, size, spans, BUF_SIZE / PGSIZE + 2);
+    if (count < 0) {
+        printf("t_pin failed\n");
+        exit(1);
+    }
+    t_unpin(spans, count);
+    return count;
+}
+
+// MiB/s of copying size bytes at va out with one get_value(), best of 3
+double copy_bandwidth(char *va, unsigned long size) {
+    double best = 0;
+    for (int i = 0; i < 3; i++) {
+        double start = now_ns();
+        get_value(va, copy, size);
+        double rate = size / 1048576.0 / ((now_ns() - start) / 1e9);
+        best = rate > best ? rate : best;
+    }
+    return best;
+}
+
+void interleaved() {
+    char *bufs[BUFFERS];
+    for (int b = 0; b < BUFFERS; b++)
+        bufs[b] = t_malloc(BUF_SIZE);
+    for (unsigned long p = 0; p < BUF_SIZE; p += PGSIZE)
+        for (int b = 0; b < BUFFERS; b++)
+            put_value(bufs[b] + p, &p, sizeof(p));
+
+    double spans_total = 0, rate_total = 0;
+    for (int b = 0; b < BUFFERS; b++) {
+        spans_total += count_spans(bufs[b], BUF_SIZE);
+        rate_total += copy_bandwidth(bufs[b], BUF_SIZE);
+    }
+    printf("%10.1f %12.0f\n", spans_total / BUFFERS, rate_total / BUFFERS);
+    for (int b = 0; b < BUFFERS; b++)
+        t_free(bufs[b], BUF_SIZE);
+}
+
+void churn() {
+    char *slot_va[SLOTS] = {0};
+    unsigned long slot_size[SLOTS] = {0};
+    unsigned int seed = 1;
+    printf("\nchurn\n");
+    printf("%6s %10s %10s %10s %10s %10s %10s\n", "step", "pages/span", "MiB/s", "free runs", "largest",
+           "order 0", "order 9");
+
+    for (int step = 1; step <= ROUNDS; step++) {
+        int i = rand_r(&seed) % SLOTS;
+        if (slot_va[i] != NULL)
+            t_free(slot_va[i], slot_size[i]);
+        slot_size[i] = (1 + rand_r(&seed) % MAX_PAGES) * PGSIZE;
+        slot_va[i] = t_malloc(slot_size[i]);
+        put_value(slot_va[i], copy, slot_size[i]);
+        if (step % INTERVAL != 0)
+            continue;
+
+        unsigned long pages = 0, span_count = 0;
+        for (int s = 0; s < SLOTS; s++) {
+            if (slot_va[s] == NULL)
+                continue;
+            pages += slot_size[s] / PGSIZE;
+            span_count += count_spans(slot_va[s], slot_size[s]);
+        }
+        char *fresh = t_malloc(BUF_SIZE);
+        put_value(fresh, copy, BUF_SIZE);
+        double rate = copy_bandwidth(fresh, BUF_SIZE);
+        t_free(fresh, BUF_SIZE);
+
+        struct frame_stats stats;
+        get_frame_stats(&stats);
+        printf("%6d %10.1f %10.0f %10lu %10lu %10lu %10lu\n", step, (double)pages / span_count, rate, stats.free_runs,
+               stats.largest_free_run, stats.free_blocks[0], stats.free_blocks[VM_FRAME_ORDERS - 1]);
+    }
+    for (int s = 0; s < SLOTS; s++)
+        if (slot_va[s] != NULL)
+            t_free(slot_va[s], slot_size[s]);
+}
+
+int main() {
+    copy = malloc(BUF_SIZE);
+    memset(copy, 1, BUF_SIZE);
+    set_large_pages(false);
+    t_free(t_malloc(1), 1);
+
+    printf("%d buffers of %d MiB written a page of each at a time\n", BUFFERS, BUF_SIZE >> 20);
+    printf("%10s %12s\n", "spans", "copy MiB/s");
+    interleaved();
+    churn();
+    free(copy);
+    return 0;
+}
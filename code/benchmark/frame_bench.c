@@ -0,0 +1,57 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Allocates every physical frame through get_next_page() and reports the
+// average allocation latency for each tenth of the memory, then frees them
+// all and repeats the fill to show that reused frames cost the same.
+
+#define NUM_FRAMES (MEMSIZE / PGSIZE)
+#define BUCKETS 10
+
+long frames[NUM_FRAMES];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+long fill(const char *label) {
+    long count = 0;
+    long per_bucket = NUM_FRAMES / BUCKETS;
+    printf("%s\n", label);
+    for (int b = 0; b < BUCKETS; b++) {
+        double start = now_ns();
+        long done = 0;
+        for (long i = 0; i < per_bucket; i++) {
+            long pa = get_next_page();
+            if (pa < 0)
+                break;
+            frames[count++] = pa;
+            done++;
+        }
+        double elapsed = now_ns() - start;
+        if (done > 0)
+            printf("  occupancy %3d%%-%3d%%: %8.1f ns/alloc\n", b * 100 / BUCKETS,
+                   (b + 1) * 100 / BUCKETS, elapsed / done);
+    }
+    long pa;
+    while ((pa = get_next_page()) >= 0)
+        frames[count++] = pa;
+    printf("  allocated %ld frames before exhaustion\n", count);
+    return count;
+}
+
+int main() {
+    set_physical_mem();
+
+    long count = fill("Filling physical memory");
+
+    double start = now_ns();
+    for (long i = 0; i < count; i++)
+        free_page(frames[i]);
+    printf("Freed %ld frames: %.1f ns/free\n", count, (now_ns() - start) / count);
+
+    fill("Refilling physical memory");
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Reads random words of a 64 MiB buffer mapped with large pages and then
+// with small pages, printing the TLB counters of each run (the counters are
+// reset in between by reapplying the default TLB configuration).
+
+#define BUFFER_SIZE (64 * 1024 * 1024)
+#define READS 1000000
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void run(bool large) {
+    set_large_pages(large);
+    char *buf = t_malloc(BUFFER_SIZE);
+    set_TLB_config(TLB_ENTRIES, TLB_DEFAULT_WAYS, TLB_LRU);
+
+    unsigned int seed = 12345, val;
+    double start = now_ns();
+    for (int i = 0; i < READS; i++) {
+        seed = seed * 1103515245 + 12345;
+        get_value(buf + (seed % (BUFFER_SIZE / sizeof(int))) * sizeof(int), &val, sizeof(int));
+    }
+    double ns = (now_ns() - start) / READS;
+
+    printf("%s pages: %.1f ns/read\n", large ? "large" : "small", ns);
+    fflush(stdout);
+    print_TLB_missrate();
+    t_free(buf, BUFFER_SIZE);
+}
+
+int main() {
+    run(true);
+    run(false);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Times mat_mult() for sizes from 5 to 1024 and checks every result against
+// a plain triple loop in host memory. Up to 128 it also times the element
+// by element get_value/put_value multiply mat_mult() used to do.
+
+#define MAX_SIZE 1024
+
+unsigned int host_a[MAX_SIZE * MAX_SIZE], host_b[MAX_SIZE * MAX_SIZE];
+unsigned int expected[MAX_SIZE * MAX_SIZE], result[MAX_SIZE * MAX_SIZE];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void elementwise_mult(char *mat1, char *mat2, int size, char *answer) {
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            unsigned int a, b, c = 0;
+            for (int k = 0; k < size; k++) {
+                get_value(mat1 + (i * size + k) * sizeof(int), &a, sizeof(int));
+                get_value(mat2 + (k * size + j) * sizeof(int), &b, sizeof(int));
+                c += a * b;
+            }
+            put_value(answer + (i * size + j) * sizeof(int), &c, sizeof(int));
+        }
+    }
+}
+
+int main() {
+    int sizes[] = {5, 16, 64, 128, 256, 512, 1024};
+    int n = sizeof(sizes) / sizeof(sizes[0]);
+
+    printf("%6s %14s %14s %10s\n", "size", "mat_mult ms", "elementwise ms", "Gmul/s");
+    for (int s = 0; s < n; s++) {
+        int size = sizes[s];
+        unsigned long bytes = (unsigned long)size * size * sizeof(int);
+        unsigned int seed = size;
+        for (int i = 0; i < size * size; i++) {
+            seed = seed * 1103515245 + 12345;
+            host_a[i] = seed;
+            seed = seed * 1103515245 + 12345;
+            host_b[i] = seed >> 3;
+        }
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < size; j++) {
+                unsigned int c = 0;
+                for (int k = 0; k < size; k++)
+                    c += host_a[i * size + k] * host_b[k * size + j];
+                expected[i * size + j] = c;
+            }
+        }
+
+        char *a = t_malloc(bytes), *b = t_malloc(bytes), *c = t_malloc(bytes);
+        put_value(a, host_a, bytes);
+        put_value(b, host_b, bytes);
+
+        double start = now_ns();
+        mat_mult(a, b, size, c);
+        double tiled_ns = now_ns() - start;
+        get_value(c, result, bytes);
+        if (memcmp(result, expected, bytes) != 0) {
+            printf("mat_mult result differs at size %d\n", size);
+            return 1;
+        }
+
+        double elementwise_ns = 0;
+        if (size <= 128) {
+            start = now_ns();
+            elementwise_mult(a, b, size, c);
+            elementwise_ns = now_ns() - start;
+        }
+
+        printf("%6d %14.3f %14.3f %10.2f\n", size, tiled_ns / 1e6, elementwise_ns / 1e6,
+               (double)size * size * size / tiled_ns);
+        t_free(a, bytes);
+        t_free(b, bytes);
+        t_free(c, bytes);
+    }
+    return 0;
+}
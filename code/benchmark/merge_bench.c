@@ -0,0 +1,101 @@
+#include <time.h>
+#include <unistd.h>
+#include "../my_vm.h"
+
+// Frames used by sparse matrices: two SIZE x SIZE operands with nonzeros
+// in one row out of every SPARSE_ROWS, and their product, which is just as
+// sparse. Counts the frames in use after t_malloc(), after writing the
+// operands in full and multiplying, and once the merge scanner has folded
+// the zero and duplicate pages back into shared frames, along with what
+// the scanner cost. Small pages, as the scanner does not split large ones.
+
+#define SIZE 1024
+#define SPARSE_ROWS 16
+#define PAGES_PER_ROUND 4096
+#define INTERVAL_MS 10
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+unsigned long resident() {
+    struct paging_stats stats;
+    get_paging_stats(&stats);
+    return stats.resident;
+}
+
+// Row i of an operand: small values on sparse rows, zero elsewhere
+void fill_row(unsigned int *row, int i, unsigned int seed) {
+    for (int j = 0; j < SIZE; j++)
+        row[j] = i % SPARSE_ROWS == 0 ? (i * 131 + j * 17 + seed) % 251 : 0;
+}
+
+int main() {
+    unsigned long bytes = (unsigned long)SIZE * SIZE * sizeof(unsigned int);
+    unsigned int *row = malloc(SIZE * sizeof(unsigned int));
+    unsigned int *b_col = malloc(SIZE * sizeof(unsigned int));
+    set_large_pages(false);
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the counts
+
+    unsigned long base = resident();
+    char *a = t_malloc(bytes);
+    char *b = t_malloc(bytes);
+    char *c = t_malloc(bytes);
+    printf("%d x %d matrices, nonzero rows 1 in %d, %lu pages each\n", SIZE, SIZE, SPARSE_ROWS, bytes / PGSIZE);
+    printf("%-22s %8lu frames\n", "after t_malloc", resident() - base);
+
+    for (int i = 0; i < SIZE; i++) {
+        fill_row(row, i, 1);
+        put_value(a + (unsigned long)i * SIZE * sizeof(unsigned int), row, SIZE * sizeof(unsigned int));
+        fill_row(row, i, 2);
+        put_value(b + (unsigned long)i * SIZE * sizeof(unsigned int), row, SIZE * sizeof(unsigned int));
+    }
+    mat_mult(a, b, SIZE, c);
+    printf("%-22s %8lu frames\n", "after fill + mat_mult", resident() - base);
+
+    struct merge_stats before, stats;
+    get_merge_stats(&before);
+    double start = now_ns();
+    set_merge_config(PAGES_PER_ROUND, INTERVAL_MS);
+    unsigned long last = ~0UL;
+    for (;;) { // until a full second passes without a merge
+        usleep(1000000);
+        get_merge_stats(&stats);
+        if (stats.merged == last)
+            break;
+        last = stats.merged;
+    }
+    set_merge_config(0, 0);
+    double wall_ms = (now_ns() - start) / 1e6;
+    printf("%-22s %8lu frames\n", "after merging", resident() - base);
+    printf("merged %lu pages, %lu frames saved, %lu on the zero page\n", stats.merged - before.merged,
+           stats.frames_saved, stats.zero_pages);
+    printf("scanner: %lu pages hashed, %.1f ms CPU in %.0f ms, %.0f ns per page\n", stats.scanned - before.scanned,
+           (stats.scan_ns - before.scan_ns) / 1e6, wall_ms,
+           (double)(stats.scan_ns - before.scan_ns) / (stats.scanned - before.scanned));
+
+    // spot check the product against the operands
+    for (int i = 0; i < SIZE; i += SPARSE_ROWS / 2) {
+        int j = (i * 7) % SIZE;
+        unsigned int want = 0, got;
+        fill_row(row, i, 1);
+        for (int k = 0; k < SIZE; k++) {
+            get_value(b + ((unsigned long)k * SIZE + j) * sizeof(unsigned int), &b_col[k], sizeof(unsigned int));
+            want += row[k] * b_col[k];
+        }
+        get_value(c + ((unsigned long)i * SIZE + j) * sizeof(unsigned int), &got, sizeof(unsigned int));
+        if (got != want) {
+            printf("product differs at %d, %d\n", i, j);
+            exit(1);
+        }
+    }
+
+    t_free(a, bytes);
+    t_free(b, bytes);
+    t_free(c, bytes);
+    free(row);
+    free(b_col);
+    return 0;
+}
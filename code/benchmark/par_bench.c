@@ -0,0 +1,60 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Times one large mat_mult() (1024 by default, or the first argument) with
+// 1, 2, 4, ... up to N threads (second argument, 8 by default) and reports
+// the speedup over one thread. Every result is checked against the single
+// threaded one.
+
+#define MAX_SIZE 2048
+
+unsigned int host_a[MAX_SIZE * MAX_SIZE], host_b[MAX_SIZE * MAX_SIZE];
+unsigned int expected[MAX_SIZE * MAX_SIZE], result[MAX_SIZE * MAX_SIZE];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 1024;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+    if (size < 1 || size > MAX_SIZE)
+        size = 1024;
+    if (max_threads < 1 || max_threads > 64)
+        max_threads = 8;
+
+    unsigned long bytes = (unsigned long)size * size * sizeof(int);
+    char *a = t_malloc(bytes), *b = t_malloc(bytes), *c = t_malloc(bytes);
+    for (unsigned long i = 0; i < (unsigned long)size * size; i++) {
+        host_a[i] = (unsigned int)(i * 7 + 1);
+        host_b[i] = (unsigned int)(i * 13 + 5);
+    }
+    put_value(a, host_a, bytes);
+    put_value(b, host_b, bytes);
+
+    printf("size %d\n", size);
+    printf("threads %10s %8s\n", "ms", "speedup");
+    double base = 0;
+    for (int n = 1; n <= max_threads; n *= 2) {
+        set_mat_threads(n);
+        mat_mult(a, b, size, c); // start the pool and warm every worker's TLB
+        double start = now_ns();
+        mat_mult(a, b, size, c);
+        double ms = (now_ns() - start) / 1e6;
+
+        get_value(c, n == 1 ? expected : result, bytes);
+        if (n > 1 && memcmp(expected, result, bytes) != 0) {
+            printf("result with %d threads differs from the single threaded one\n", n);
+            return 1;
+        }
+        if (n == 1)
+            base = ms;
+        printf("%7d %10.2f %8.2f\n", n, ms, base / ms);
+    }
+    t_free(a, bytes);
+    t_free(b, bytes);
+    t_free(c, bytes);
+    return 0;
+}
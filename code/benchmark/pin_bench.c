@@ -0,0 +1,76 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Sums and then increments every int of a SIZE byte buffer three ways:
+// one get_value()/put_value() per int, one bulk get_value()/put_value()
+// through a host copy, and through the host pointers t_pin() returns.
+// Prints the time per int of each and the number of spans the pinned
+// buffer took.
+
+#define SIZE (16 * 1024 * 1024)
+#define INTS (SIZE / sizeof(int))
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+    char *va = t_malloc(SIZE);
+    int *copy = malloc(SIZE);
+    for (unsigned long i = 0; i < INTS; i++)
+        copy[i] = i;
+    put_value(va, copy, SIZE);
+
+    long sum = 0;
+    double start = now_ns();
+    for (unsigned long i = 0; i < INTS; i++) {
+        int val;
+        get_value(va + i * sizeof(int), &val, sizeof(int));
+        sum += val;
+        val++;
+        put_value(va + i * sizeof(int), &val, sizeof(int));
+    }
+    double single_ns = now_ns() - start;
+
+    start = now_ns();
+    get_value(va, copy, SIZE);
+    for (unsigned long i = 0; i < INTS; i++)
+        sum += copy[i]++;
+    put_value(va, copy, SIZE);
+    double bulk_ns = now_ns() - start;
+
+    int max_spans = SIZE / PGSIZE + 2;
+    struct t_iovec *spans = malloc(max_spans * sizeof(struct t_iovec));
+    start = now_ns();
+    int count = t_pin(va, SIZE, spans, max_spans);
+    if (count < 0) {
+        printf("t_pin failed\n");
+        return 1;
+    }
+    for (int s = 0; s < count; s++) {
+        int *p = spans[s].buf;
+        for (unsigned long i = 0; i < spans[s].len / sizeof(int); i++)
+            sum += p[i]++;
+    }
+    t_unpin(spans, count);
+    double pinned_ns = now_ns() - start;
+
+    for (unsigned long i = 0; i < INTS; i += 4096) {
+        int val;
+        get_value(va + i * sizeof(int), &val, sizeof(int));
+        if (val != (int)i + 3) {
+            printf("wrong value at %lu\n", i);
+            return 1;
+        }
+    }
+    printf("%d MiB, %d spans pinned, checksum %ld\n", SIZE >> 20, count, sum);
+    printf("%-8s %10s\n", "access", "ns/int");
+    printf("%-8s %10.2f\n", "single", single_ns / INTS);
+    printf("%-8s %10.2f\n", "bulk", bulk_ns / INTS);
+    printf("%-8s %10.2f\n", "pinned", pinned_ns / INTS);
+    free(spans);
+    free(copy);
+    return 0;
+}
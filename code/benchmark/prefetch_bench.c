@@ -0,0 +1,78 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Scans a 64 MiB buffer with 16 MiB of frames allowed, so every page of a
+// scan has to come back from swap, with read-ahead off and on. The scans
+// read every page, every fourth page, and write every page (which also
+// leaves each evicted page to the write-back thread). At the limit no frame
+// is free, so nothing is read ahead. The reload scan then reads the first
+// 16 MiB back after a filler buffer pushed them out and was freed, leaving
+// free frames to read ahead into. Reports the time accesses stalled on
+// faults, the faults taken and the pages read ahead.
+
+#define BUFFER_SIZE (64 * 1024 * 1024)
+#define RESIDENT (16 * 1024 * 1024)
+#define PAGES (BUFFER_SIZE / PGSIZE)
+
+char *buf;
+char page[PGSIZE];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void scan(const char *label, unsigned int pages, int stride, bool write, bool prefetch) {
+    struct paging_stats before, after;
+    set_prefetch(prefetch);
+    get_paging_stats(&before);
+    double start = now_ns();
+    for (unsigned int p = 0; p < pages; p += stride) {
+        char *va = buf + (unsigned long)p * PGSIZE;
+        if (write) {
+            memset(page, p, sizeof(unsigned int));
+            put_value(va, page, PGSIZE);
+        } else {
+            get_value(va, page, PGSIZE);
+            if (page[0] != (char)p) {
+                printf("page %u holds %d\n", p, page[0]);
+                exit(1);
+            }
+        }
+    }
+    double ms = (now_ns() - start) / 1e6;
+    get_paging_stats(&after);
+    printf("%-10s %-4s %9.1f %9.1f %8lu %10lu\n", label, prefetch ? "on" : "off", ms,
+           (after.stall_ns - before.stall_ns) / 1e6, after.faults - before.faults,
+           after.prefetched - before.prefetched);
+}
+
+int main() {
+    set_large_pages(false); // large pages are never evicted
+    set_paging_config(RESIDENT, EVICT_CLOCK, NULL);
+    buf = t_malloc(BUFFER_SIZE);
+    for (unsigned int p = 0; p < PAGES; p++) {
+        memset(page, p, PGSIZE);
+        put_value(buf + (unsigned long)p * PGSIZE, page, PGSIZE);
+    }
+
+    printf("%d KiB buffer, %d KiB resident\n", BUFFER_SIZE / 1024, RESIDENT / 1024);
+    printf("%-10s %-4s %9s %9s %8s %10s\n", "scan", "read", "total ms", "stall ms", "faults", "prefetched");
+    bool modes[] = {false, true};
+    for (int m = 0; m < 2; m++) {
+        scan("sequential", PAGES, 1, false, modes[m]);
+        scan("stride 4", PAGES, 4, false, modes[m]);
+        scan("write", PAGES, 1, true, modes[m]);
+    }
+    for (int m = 0; m < 2; m++) {
+        set_prefetch(false);
+        char *filler = t_malloc(RESIDENT);
+        for (unsigned long off = 0; off < RESIDENT; off += PGSIZE)
+            put_value(filler + off, page, PGSIZE);
+        t_free(filler, RESIDENT);
+        scan("reload", RESIDENT / PGSIZE, 1, false, modes[m]);
+    }
+    t_free(buf, BUFFER_SIZE);
+    return 0;
+}
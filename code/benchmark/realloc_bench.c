@@ -0,0 +1,101 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Grows a written buffer from 100 MiB to 200 MiB three ways: t_realloc()
+// with the pages after it free, t_realloc() with another allocation in
+// the way so the mappings have to move, and the t_malloc(), get_value(),
+// put_value(), t_free() sequence it replaces. Then checks the data and
+// that the new half reads as zero. With small pages and with large ones.
+
+#define OLD_SIZE (100 * 1024 * 1024)
+#define NEW_SIZE (200 * 1024 * 1024)
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+char *make_buffer() {
+    char *va = t_malloc(OLD_SIZE);
+    for (unsigned long p = 0; p < OLD_SIZE; p += PGSIZE)
+        put_value(va + p, &p, sizeof(unsigned long));
+    return va;
+}
+
+void check_buffer(char *va) {
+    for (unsigned long p = 0; p < NEW_SIZE; p += PGSIZE) {
+        unsigned long val;
+        get_value(va + p, &val, sizeof(unsigned long));
+        if (val != (p < OLD_SIZE ? p : 0)) {
+            printf("wrong value at offset %lu\n", p);
+            exit(1);
+        }
+    }
+}
+
+// Takes pages until one lands between from and to, so that range is not free
+char *block(char *from, char *to) {
+    static char *spare[1 << 16];
+    int count = 0;
+    char *va;
+    while ((va = t_malloc(PGSIZE)) < from || va >= to) {
+        if (count == 1 << 16) {
+            printf("could not place an allocation after the buffer\n");
+            exit(1);
+        }
+        spare[count++] = va;
+    }
+    while (count > 0)
+        t_free(spare[--count], PGSIZE);
+    return va;
+}
+
+void run(bool large, const char *label, char *copy) {
+    set_large_pages(large);
+
+    char *va = make_buffer();
+    double start = now_ns();
+    char *grown = t_realloc(va, OLD_SIZE, NEW_SIZE);
+    double in_place_ns = now_ns() - start;
+    if (grown != va) {
+        printf("growth did not happen in place\n");
+        exit(1);
+    }
+    check_buffer(grown);
+    t_free(grown, NEW_SIZE);
+
+    va = make_buffer();
+    char *blocker = block(va + OLD_SIZE, va + NEW_SIZE);
+    start = now_ns();
+    grown = t_realloc(va, OLD_SIZE, NEW_SIZE);
+    double moved_ns = now_ns() - start;
+    check_buffer(grown);
+    t_free(grown, NEW_SIZE);
+    t_free(blocker, PGSIZE);
+
+    va = make_buffer();
+    start = now_ns();
+    grown = t_malloc(NEW_SIZE);
+    get_value(va, copy, OLD_SIZE);
+    put_value(grown, copy, OLD_SIZE);
+    t_free(va, OLD_SIZE);
+    double copy_ns = now_ns() - start;
+    check_buffer(grown);
+    t_free(grown, NEW_SIZE);
+
+    printf("%-6s %12.1f %12.1f %12.1f\n", label, in_place_ns / 1e3, moved_ns / 1e3, copy_ns / 1e3);
+}
+
+int main() {
+    char *copy = malloc(OLD_SIZE);
+    memset(copy, 0, OLD_SIZE);
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the timings
+
+    printf("growing %d MiB to %d MiB\n", OLD_SIZE >> 20, NEW_SIZE >> 20);
+    printf("%-6s %12s %12s %12s\n", "pages", "in place us", "moved us", "copy us");
+    run(false, "small", copy);
+    run(true, "large", copy);
+    free(copy);
+    return 0;
+}
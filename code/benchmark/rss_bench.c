@@ -0,0 +1,50 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Reports how long the first t_malloc() takes, which includes setting up
+// physical memory, and the resident set size of the process at each step:
+// before the library is used, after that first call, after writing 64 MiB
+// through put_value and after freeing it again.
+
+#define TOUCH_BYTES (64 * 1024 * 1024)
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double rss_mib() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident * 4096.0 / (1024 * 1024);
+}
+
+int main() {
+    char *chunk = malloc(PGSIZE);
+    memset(chunk, 0x5a, PGSIZE);
+
+    printf("%-28s %9.1f MiB\n", "RSS before first call", rss_mib());
+
+    double start = now_ns();
+    void *first = t_malloc(1);
+    double first_ms = (now_ns() - start) / 1e6;
+    printf("%-28s %9.1f MiB\n", "RSS after first call", rss_mib());
+    printf("%-28s %9.2f ms\n", "first t_malloc latency", first_ms);
+
+    char *va = t_malloc(TOUCH_BYTES);
+    for (unsigned long off = 0; off < TOUCH_BYTES; off += PGSIZE)
+        put_value(va + off, chunk, PGSIZE);
+    printf("%-28s %9.1f MiB\n", "RSS after writing 64 MiB", rss_mib());
+
+    t_free(va, TOUCH_BYTES);
+    printf("%-28s %9.1f MiB\n", "RSS after freeing it", rss_mib());
+
+    t_free(first, 1);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Runs the same put_value/get_value mix on 1 to N threads (N is the first
+// argument, 16 by default), each thread on its own buffer, and reports the
+// total throughput for every thread count.
+
+#define MAX_THREADS 64
+#define BUFFER_SIZE (16 * PGSIZE)
+#define OPS_PER_THREAD 200000
+
+pthread_t threads[MAX_THREADS];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 2654435761u + 1;
+    char *buf = t_malloc(BUFFER_SIZE);
+    int slots = BUFFER_SIZE / sizeof(int);
+    for (int i = 0; i < OPS_PER_THREAD / 2; i++) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 8) % slots;
+        int val = i, got;
+        put_value(buf + slot * sizeof(int), &val, sizeof(int));
+        get_value(buf + slot * sizeof(int), &got, sizeof(int));
+        if (got != val) {
+            printf("thread %ld read %d, expected %d\n", (long)arg, got, val);
+            exit(1);
+        }
+    }
+    t_free(buf, BUFFER_SIZE);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    if (max_threads < 1 || max_threads > MAX_THREADS)
+        max_threads = 16;
+
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the timings
+
+    printf("threads   ops/sec\n");
+    for (int n = 1; n <= max_threads; n *= 2) {
+        double start = now_ns();
+        for (int i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, worker, (void *)(long)i);
+        for (int i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        double seconds = (now_ns() - start) / 1e9;
+        printf("%7d %9.0f\n", n, (double)n * OPS_PER_THREAD / seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Compares small allocations served from slab pages with the page granular
+// path (one whole page per object, which t_malloc(PGSIZE) still takes).
+// Memory efficiency is requested bytes over the bytes of the distinct
+// virtual pages the objects landed on.
+
+#define OBJECTS 10000
+
+void *objs[OBJECTS];
+unsigned long pages[OBJECTS];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int cmp_page(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+long distinct_pages() {
+    for (int i = 0; i < OBJECTS; i++)
+        pages[i] = (unsigned long)objs[i] / PGSIZE;
+    qsort(pages, OBJECTS, sizeof(unsigned long), cmp_page);
+    long count = 1;
+    for (int i = 1; i < OBJECTS; i++)
+        if (pages[i] != pages[i - 1])
+            count++;
+    return count;
+}
+
+void run(unsigned int size, unsigned int alloc_size, const char *label) {
+    double start = now_ns();
+    for (int i = 0; i < OBJECTS; i++)
+        objs[i] = t_malloc(alloc_size);
+    double alloc_ns = (now_ns() - start) / OBJECTS;
+
+    long used = distinct_pages();
+
+    start = now_ns();
+    for (int i = 0; i < OBJECTS; i++)
+        t_free(objs[i], alloc_size);
+    double free_ns = (now_ns() - start) / OBJECTS;
+
+    printf("%-6s %5u bytes: %6ld pages, efficiency %6.2f%%, %8.1f ns/malloc, %8.1f ns/free\n",
+           label, size, used, 100.0 * size * OBJECTS / ((double)used * PGSIZE), alloc_ns, free_ns);
+}
+
+int main() {
+    unsigned int sizes[] = {4, 10, 64, 100, 400, 1000};
+    int n = sizeof(sizes) / sizeof(sizes[0]);
+
+    t_free(t_malloc(1), 1); // keep physical memory setup out of the timings
+
+    printf("%d objects per run\n", OBJECTS);
+    for (int i = 0; i < n; i++) {
+        run(sizes[i], sizes[i], "slab");
+        run(sizes[i], PGSIZE, "paged");
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "../my_vm.h"
+
+// Translations a thread caches while mapping memory must not outlive a
+// switch of address space. Space 1 maps a buffer of large pages with the
+// TLB last used in space 0, then space 0 maps single pages at the same
+// addresses and writes them once all are mapped. None of the writes may
+// land in space 1's buffer. Exits 1 if any did.
+
+#define PAGES 2048
+
+int main() {
+    char *warm = t_malloc(PGSIZE);
+    unsigned long zero = 0;
+    put_value(warm, &zero, sizeof(zero));
+
+    int id = t_clone();
+    if (id < 0 || t_switch(id) != 0) {
+        printf("t_clone failed\n");
+        return 1;
+    }
+    char *theirs = t_malloc(PAGES * PGSIZE);
+    t_switch(0);
+
+    char *mine[PAGES];
+    for (unsigned long p = 0; p < PAGES; p++)
+        mine[p] = t_malloc(PGSIZE);
+    for (unsigned long p = 0; p < PAGES; p++)
+        put_value(mine[p], &p, sizeof(p));
+
+    t_switch(id);
+    unsigned long foreign = 0;
+    for (unsigned long p = 0; p < PAGES; p++) {
+        unsigned long value;
+        get_value(theirs + p * PGSIZE, &value, sizeof(value));
+        foreign += value != 0;
+    }
+    t_switch(0);
+    for (unsigned long p = 0; p < PAGES; p++) {
+        unsigned long value;
+        get_value(mine[p], &value, sizeof(value));
+        foreign += value != p;
+    }
+
+    printf("%lu of %d pages written through another space's translations\n", foreign, 2 * PAGES);
+    return foreign != 0;
+}
@@ -0,0 +1,74 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Oversubscribes memory 4x: a 64 MiB buffer is used with only 16 MiB of
+// frames allowed, under each eviction policy. Every page is written once,
+// then pages are picked at random with 90% of the picks going to a hot
+// eighth of the buffer, and each pick either rewrites the page's first word
+// or reads it back and checks it. Reports faults and writebacks per access
+// and the access throughput.
+
+#define BUFFER_SIZE (64 * 1024 * 1024)
+#define RESIDENT (16 * 1024 * 1024)
+#define PAGES (BUFFER_SIZE / PGSIZE)
+#define HOT_PAGES (PAGES / 8)
+#define ACCESSES 400000
+
+unsigned int stamps[PAGES];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void run(enum evict_policy policy, const char *label) {
+    struct paging_stats before, after;
+    set_paging_config(RESIDENT, policy, NULL);
+    char *buf = t_malloc(BUFFER_SIZE);
+
+    for (unsigned int p = 0; p < PAGES; p++) {
+        stamps[p] = p;
+        put_value(buf + (unsigned long)p * PGSIZE, &stamps[p], sizeof(unsigned int));
+    }
+
+    get_paging_stats(&before);
+    unsigned int seed = 12345, val;
+    double start = now_ns();
+    for (int i = 0; i < ACCESSES; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = seed >> 4;
+        unsigned int p = r % 10 < 9 ? (r / 10) % HOT_PAGES : (r / 10) % PAGES;
+        char *va = buf + (unsigned long)p * PGSIZE;
+        if (r & 1) {
+            stamps[p] += PAGES;
+            put_value(va, &stamps[p], sizeof(unsigned int));
+        } else {
+            get_value(va, &val, sizeof(unsigned int));
+            if (val != stamps[p]) {
+                printf("page %u read %u, expected %u\n", p, val, stamps[p]);
+                exit(1);
+            }
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    get_paging_stats(&after);
+
+    printf("%-10s %8.4f %10.4f %10.4f %12.0f %8lu\n", label,
+           (double)(after.faults - before.faults) / ACCESSES,
+           (double)(after.evictions - before.evictions) / ACCESSES,
+           (double)(after.writebacks - before.writebacks) / ACCESSES, ACCESSES / seconds,
+           after.resident * PGSIZE / 1024);
+    t_free(buf, BUFFER_SIZE);
+}
+
+int main() {
+    set_large_pages(false); // large pages are never evicted
+    printf("%d KiB buffer, %d KiB resident, %d accesses\n", BUFFER_SIZE / 1024, RESIDENT / 1024, ACCESSES);
+    printf("%-10s %8s %10s %10s %12s %8s\n", "policy", "faults", "evictions", "writebacks", "accesses/s",
+           "KiB used");
+    run(EVICT_CLOCK, "clock");
+    run(EVICT_LRU_APPROX, "lru-approx");
+    run(EVICT_2Q, "2q");
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include <unistd.h>
+#include "../my_vm.h"
+
+// Replays a trace written between t_trace_start() and t_trace_stop()
+// against many TLB geometries at once and prints their miss-rate curves
+// as CSV: page size, policy, ways, entries, misses, accesses, miss rate.
+// Every thread gets TLBs of its own, as in the library.
+//
+//   tlb_sim [-p shifts] [-w ways] [-e entries] TRACE
+//
+// LRU needs no TLB per geometry: one pass keeps a stack of the last
+// MAX_WAYS pages of every set for each power of two of sets, and the
+// depth a page is found at tells every associativity at once whether it
+// hits (Mattson's stack algorithm). Fully associative LRU takes the
+// number of distinct pages since the last access to the same page,
+// counted with a Fenwick tree over access times. PLRU, CLOCK and RANDOM
+// have no stack property, so they are simulated directly, the way the
+// library does, for each of the ways in -w (4 by default). Sizes run in
+// powers of two from MIN_ENTRIES to -e, 4096 by default. -p takes a
+// comma separated list of shifts to replay the trace with pages 2^shift
+// times larger too, "0,9" for the library's small and large pages.
+// Writes are counted like reads: the library's first write through a
+// translation a read cached walks the page table but is still a hit.
+
+#define MIN_ENTRIES 16
+#define MAX_WAYS 16
+#define MAX_SHIFTS 8
+#define MAX_POLICY_WAYS 8
+
+// log2 of the largest size simulated, 12 unless -e says otherwise
+int max_log = 12;
+int shifts[MAX_SHIFTS] = {0};
+int shift_count = 1;
+int policy_ways[MAX_POLICY_WAYS] = {TLB_DEFAULT_WAYS};
+int ways_count = 1;
+static const char *policy_names[] = {"lru", "plru", "clock", "random"};
+
+// A set associative TLB simulated entry by entry
+struct cache {
+    unsigned int sets, ways;
+    enum tlb_policy policy;
+    uint64_t *tags;      // page number + 1, 0 when empty
+    uint8_t *bits;       // PLRU tree nodes, or CLOCK referenced bits
+    unsigned int *hands; // CLOCK hand of each set
+    uint64_t seed;
+    unsigned long misses;
+};
+
+// Fully associative LRU stack distances
+struct stack_dist {
+    uint32_t *tree;   // Fenwick tree, 1 at the time of each page's last access
+    uint64_t *pages;  // page accessed at each time
+    unsigned long size, now;
+    uint64_t *keys;   // hash of page + 1 to the time of its last access
+    unsigned long *times;
+    unsigned long slots, used;
+    unsigned long *hist; // accesses by distance, the last for misses beyond every size
+};
+
+// Everything simulated for one thread and one page size
+struct sim {
+    unsigned long accesses;
+    uint64_t *stacks[32];          // per log2 of sets: MAX_WAYS pages + 1 per set, most recent first
+    unsigned long *depths[32];     // per log2 of sets: hits by stack depth
+    struct stack_dist full;
+    struct cache *caches;          // PLRU, CLOCK and RANDOM for every ways and size
+    int cache_count;
+};
+
+struct sim **threads; // [thread * shift_count + shift]
+unsigned int thread_count;
+
+void *zalloc(size_t size) {
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+int find_way(struct cache *c, unsigned long set, uint64_t tag) {
+    for (unsigned int way = 0; way < c->ways; way++)
+        if (c->tags[set * c->ways + way] == tag)
+            return way;
+    return -1;
+}
+
+void touch(struct cache *c, unsigned long set, unsigned int way) {
+    if (c->policy == TLB_PLRU) {
+        uint8_t *tree = &c->bits[set * c->ways];
+        unsigned int node = 1;
+        for (unsigned int half = c->ways / 2; half > 0; half /= 2) {
+            unsigned int right = (way & half) != 0;
+            tree[node] = !right;
+            node = node * 2 + right;
+        }
+    } else if (c->policy == TLB_CLOCK) {
+        c->bits[set * c->ways + way] = 1;
+    }
+}
+
+unsigned int victim(struct cache *c, unsigned long set) {
+    unsigned long base = set * c->ways;
+    if (c->policy == TLB_PLRU) {
+        uint8_t *tree = &c->bits[base];
+        unsigned int node = 1, way = 0;
+        for (unsigned int half = c->ways / 2; half > 0; half /= 2) {
+            way = way * 2 + tree[node];
+            node = node * 2 + tree[node];
+        }
+        return way;
+    }
+    if (c->policy == TLB_CLOCK) {
+        unsigned int *hand = &c->hands[set];
+        while (c->bits[base + *hand]) {
+            c->bits[base + *hand] = 0;
+            *hand = (*hand + 1) % c->ways;
+        }
+        unsigned int way = *hand;
+        *hand = (*hand + 1) % c->ways;
+        return way;
+    }
+    c->seed ^= c->seed << 13;
+    c->seed ^= c->seed >> 7;
+    c->seed ^= c->seed << 17;
+    return c->seed % c->ways;
+}
+
+void cache_access(struct cache *c, uint64_t vpn) {
+    unsigned long set = vpn & (c->sets - 1);
+    int way = find_way(c, set, vpn + 1);
+    if (way < 0) {
+        c->misses++;
+        if ((way = find_way(c, set, 0)) < 0)
+            way = victim(c, set);
+        c->tags[set * c->ways + way] = vpn + 1;
+    }
+    touch(c, set, way);
+}
+
+unsigned long *hash_slot(struct stack_dist *s, uint64_t vpn, bool *found) {
+    unsigned long i = (vpn * 0x9E3779B97F4A7C15ULL) >> 20 & (s->slots - 1);
+    while (s->keys[i] != 0 && s->keys[i] != vpn + 1)
+        i = (i + 1) & (s->slots - 1);
+    *found = s->keys[i] != 0;
+    s->keys[i] = vpn + 1;
+    return &s->times[i];
+}
+
+void tree_add(struct stack_dist *s, unsigned long t, int n) {
+    for (t++; t <= s->size; t += t & -t)
+        s->tree[t - 1] += n;
+}
+
+// Ones at times before t
+unsigned long tree_sum(struct stack_dist *s, unsigned long t) {
+    unsigned long sum = 0;
+    for (; t > 0; t -= t & -t)
+        sum += s->tree[t - 1];
+    return sum;
+}
+
+void grow_hash(struct stack_dist *s) {
+    uint64_t *keys = s->keys;
+    unsigned long *times = s->times;
+    unsigned long slots = s->slots;
+    s->slots = slots == 0 ? 1 << 12 : slots * 2;
+    s->keys = zalloc(s->slots * sizeof(uint64_t));
+    s->times = zalloc(s->slots * sizeof(unsigned long));
+    for (unsigned long i = 0; i < slots; i++) {
+        bool found;
+        if (keys[i] != 0)
+            *hash_slot(s, keys[i] - 1, &found) = times[i];
+    }
+    free(keys);
+    free(times);
+}
+
+// Renumbers the last accesses 0, 1, ... once the times run out
+void compact(struct stack_dist *s) {
+    uint64_t *pages = s->pages;
+    unsigned long size = s->size, now = 0;
+    s->size = s->used * 4 > (1 << 16) ? s->used * 4 : 1 << 16;
+    free(s->tree);
+    s->tree = zalloc(s->size * sizeof(uint32_t));
+    s->pages = zalloc(s->size * sizeof(uint64_t));
+    for (unsigned long t = 0; t < size && pages != NULL; t++) {
+        bool found;
+        unsigned long *time = hash_slot(s, pages[t], &found);
+        if (*time == t) {
+            *time = now;
+            s->pages[now] = pages[t];
+            tree_add(s, now++, 1);
+        }
+    }
+    s->now = now;
+    free(pages);
+}
+
+void full_access(struct stack_dist *s, uint64_t vpn) {
+    unsigned long limit = 1UL << max_log;
+    if (s->used * 2 >= s->slots)
+        grow_hash(s);
+    if (s->now == s->size)
+        compact(s);
+    bool found;
+    unsigned long *time = hash_slot(s, vpn, &found);
+    if (found) {
+        unsigned long distance = tree_sum(s, s->now) - tree_sum(s, *time + 1);
+        s->hist[distance < limit ? distance : limit]++;
+        tree_add(s, *time, -1);
+    } else {
+        s->hist[limit]++;
+        s->used++;
+    }
+    *time = s->now;
+    s->pages[s->now] = vpn;
+    tree_add(s, s->now++, 1);
+}
+
+struct sim *new_sim() {
+    struct sim *sim = zalloc(sizeof(struct sim));
+    for (int log = 0; log <= max_log; log++) {
+        sim->stacks[log] = zalloc(((size_t)MAX_WAYS + 1) * sizeof(uint64_t) << log);
+        sim->depths[log] = zalloc(MAX_WAYS * sizeof(unsigned long));
+    }
+    sim->full.hist = zalloc(((1UL << max_log) + 1) * sizeof(unsigned long));
+    sim->caches = zalloc(3 * ways_count * (max_log + 1) * sizeof(struct cache));
+    for (enum tlb_policy p = TLB_PLRU; p <= TLB_RANDOM; p++)
+        for (int w = 0; w < ways_count; w++)
+            for (int log = 0; log <= max_log; log++) {
+                unsigned long entries = 1UL << log;
+                if (entries < MIN_ENTRIES || entries < (unsigned long)policy_ways[w])
+                    continue;
+                struct cache *c = &sim->caches[sim->cache_count++];
+                c->policy = p;
+                c->ways = policy_ways[w];
+                c->sets = entries / c->ways;
+                c->tags = zalloc(entries * sizeof(uint64_t));
+                c->bits = zalloc(entries);
+                c->hands = zalloc(c->sets * sizeof(unsigned int));
+                c->seed = 0x9E3779B97F4A7C15ULL;
+            }
+    return sim;
+}
+
+void sim_access(struct sim *sim, uint64_t vpn) {
+    sim->accesses++;
+    for (int log = 0; log <= max_log; log++) {
+        // the stack keeps one page more than MAX_WAYS so that its tail shifts out
+        uint64_t *stack = &sim->stacks[log][(vpn & ((1UL << log) - 1)) * (MAX_WAYS + 1)];
+        int depth = 0;
+        while (depth < MAX_WAYS && stack[depth] != vpn + 1)
+            depth++;
+        if (depth < MAX_WAYS)
+            sim->depths[log][depth]++;
+        memmove(&stack[1], stack, depth * sizeof(uint64_t));
+        stack[0] = vpn + 1;
+    }
+    full_access(&sim->full, vpn);
+    for (int i = 0; i < sim->cache_count; i++)
+        cache_access(&sim->caches[i], vpn);
+}
+
+struct sim *thread_sim(unsigned int thread, int shift) {
+    if (thread >= thread_count) {
+        unsigned int count = thread + 1;
+        threads = realloc(threads, (size_t)count * shift_count * sizeof(struct sim *));
+        if (threads == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        memset(&threads[thread_count * shift_count], 0, (count - thread_count) * shift_count * sizeof(struct sim *));
+        thread_count = count;
+    }
+    struct sim **sim = &threads[thread * shift_count + shift];
+    if (*sim == NULL)
+        *sim = new_sim();
+    return *sim;
+}
+
+void print_row(unsigned long page_bytes, const char *policy, unsigned long ways, unsigned long entries,
+               unsigned long misses, unsigned long accesses) {
+    printf("%lu,%s,%lu,%lu,%lu,%lu,%.6f\n", page_bytes, policy, ways, entries, misses, accesses,
+           accesses == 0 ? 0 : (double)misses / accesses);
+}
+
+// Sums the threads' results for page shift s and prints its curves
+void report(unsigned long page_bytes, int s) {
+    unsigned long accesses = 0;
+    for (unsigned int t = 0; t < thread_count; t++)
+        if (threads[t * shift_count + s] != NULL)
+            accesses += threads[t * shift_count + s]->accesses;
+
+    for (unsigned long ways = 1; ways <= MAX_WAYS; ways *= 2)
+        for (int log = 1; log <= max_log; log++) {
+            if ((ways << log) < MIN_ENTRIES || (ways << log) > (1UL << max_log))
+                continue;
+            unsigned long hits = 0;
+            for (unsigned int t = 0; t < thread_count; t++) {
+                struct sim *sim = threads[t * shift_count + s];
+                for (unsigned long d = 0; sim != NULL && d < ways; d++)
+                    hits += sim->depths[log][d];
+            }
+            print_row(page_bytes, "lru", ways, ways << log, accesses - hits, accesses);
+        }
+
+    for (int log = 0; log <= max_log; log++) {
+        unsigned long entries = 1UL << log, hits = 0;
+        if (entries < MIN_ENTRIES)
+            continue;
+        for (unsigned int t = 0; t < thread_count; t++) {
+            struct sim *sim = threads[t * shift_count + s];
+            for (unsigned long d = 0; sim != NULL && d < entries; d++)
+                hits += sim->full.hist[d];
+        }
+        print_row(page_bytes, "lru", entries, entries, accesses - hits, accesses);
+    }
+
+    struct sim *first = NULL;
+    for (unsigned int t = 0; t < thread_count && first == NULL; t++)
+        first = threads[t * shift_count + s];
+    for (int i = 0; first != NULL && i < first->cache_count; i++) {
+        struct cache *c = &first->caches[i];
+        unsigned long misses = 0;
+        for (unsigned int t = 0; t < thread_count; t++)
+            if (threads[t * shift_count + s] != NULL)
+                misses += threads[t * shift_count + s]->caches[i].misses;
+        print_row(page_bytes, policy_names[c->policy], c->ways, (unsigned long)c->sets * c->ways, misses, accesses);
+    }
+}
+
+// Parses a comma separated list of at most max numbers into list
+int parse_list(char *arg, int *list, int max) {
+    int count = 0;
+    for (char *item = strtok(arg, ","); item != NULL && count < max; item = strtok(NULL, ","))
+        list[count++] = atoi(item);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w:e:")) != -1) {
+        if (opt == 'p') {
+            shift_count = parse_list(optarg, shifts, MAX_SHIFTS);
+        } else if (opt == 'w') {
+            ways_count = parse_list(optarg, policy_ways, MAX_POLICY_WAYS);
+        } else if (opt == 'e') {
+            max_log = 0;
+            while ((2UL << max_log) <= strtoul(optarg, NULL, 0) && max_log < 20)
+                max_log++;
+        } else {
+            break;
+        }
+    }
+    for (int w = 0; w < ways_count; w++)
+        if (policy_ways[w] < 1 || (policy_ways[w] & (policy_ways[w] - 1)) != 0)
+            optind = argc; // ways must be powers of two
+    if (optind != argc - 1 || shift_count == 0 || ways_count == 0 || max_log < 4) {
+        fprintf(stderr, "usage: %s [-p shift,...] [-w ways,...] [-e max entries] TRACE\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    char magic[8];
+    uint32_t header[2];
+    if (in == NULL || fread(magic, 8, 1, in) != 1 || memcmp(magic, "VMACCES1", 8) != 0 ||
+        fread(header, sizeof(header), 1, in) != 1) {
+        fprintf(stderr, "%s is not an access trace\n", argv[optind]);
+        return 1;
+    }
+    unsigned long page_bytes = header[0];
+
+    uint64_t *block = NULL;
+    size_t capacity = 0;
+    while (fread(header, sizeof(header), 1, in) == 1) {
+        if (header[1] > capacity) {
+            capacity = header[1];
+            if ((block = realloc(block, capacity * sizeof(uint64_t))) == NULL) {
+                perror("realloc");
+                return 1;
+            }
+        }
+        if (fread(block, sizeof(uint64_t), header[1], in) != header[1]) {
+            fprintf(stderr, "trace cut short\n");
+            break;
+        }
+        for (int s = 0; s < shift_count; s++) {
+            struct sim *sim = thread_sim(header[0], s);
+            for (uint32_t i = 0; i < header[1]; i++)
+                sim_access(sim, block[i] >> 1 >> shifts[s]);
+        }
+    }
+    fclose(in);
+
+    printf("page_bytes,policy,ways,entries,misses,accesses,miss_rate\n");
+    for (int s = 0; s < shift_count; s++)
+        report(page_bytes << shifts[s], s);
+    free(block);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Stores and loads 10k ints scattered over a buffer, once with a
+// put_value/get_value call per int and once as a single t_writev/t_readv
+// batch, in a shuffled order so consecutive records rarely share a page.
+
+#define RECORDS 10000
+#define STRIDE 68 // bytes between records, so pages hold a few dozen each
+
+struct t_iovec iov[RECORDS];
+int values[RECORDS], readback[RECORDS];
+unsigned long offsets[RECORDS];
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+    char *buf = t_malloc(RECORDS * STRIDE);
+
+    for (int i = 0; i < RECORDS; i++)
+        offsets[i] = (unsigned long)i * STRIDE;
+    srand(42);
+    for (int i = RECORDS - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        unsigned long t = offsets[i];
+        offsets[i] = offsets[j];
+        offsets[j] = t;
+    }
+
+    for (int i = 0; i < RECORDS; i++)
+        values[i] = i * 7 + 1;
+    double start = now_ns();
+    for (int i = 0; i < RECORDS; i++)
+        put_value(buf + offsets[i], &values[i], sizeof(int));
+    double put_ns = now_ns() - start;
+    start = now_ns();
+    for (int i = 0; i < RECORDS; i++)
+        get_value(buf + offsets[i], &readback[i], sizeof(int));
+    double get_ns = now_ns() - start;
+
+    for (int i = 0; i < RECORDS; i++) {
+        values[i] = i * 13 + 5;
+        iov[i].va = buf + offsets[i];
+        iov[i].buf = &values[i];
+        iov[i].len = sizeof(int);
+    }
+    start = now_ns();
+    t_writev(iov, RECORDS);
+    double writev_ns = now_ns() - start;
+
+    for (int i = 0; i < RECORDS; i++)
+        iov[i].buf = &readback[i];
+    start = now_ns();
+    t_readv(iov, RECORDS);
+    double readv_ns = now_ns() - start;
+
+    for (int i = 0; i < RECORDS; i++) {
+        if (readback[i] != values[i]) {
+            printf("record %d read %d, expected %d\n", i, readback[i], values[i]);
+            return 1;
+        }
+    }
+
+    printf("%d single-int puts:  %9.1f us\n", RECORDS, put_ns / 1000);
+    printf("one t_writev batch:  %9.1f us\n", writev_ns / 1000);
+    printf("%d single-int gets:  %9.1f us\n", RECORDS, get_ns / 1000);
+    printf("one t_readv batch:   %9.1f us\n", readv_ns / 1000);
+    print_TLB_missrate();
+    return 0;
+}
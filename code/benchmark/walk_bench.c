@@ -0,0 +1,58 @@
+#include <time.h>
+#include "../my_vm.h"
+
+// Measures the cost of a page table walk. With a one entry TLB, reading
+// one int from a different page every time misses on each access; the same
+// reads with the default TLB over a working set it holds hit every time.
+// The difference is the walk, timed with and without the page walk cache.
+// Build the library with -DPT_LEVELS=2, 3 or 4 to compare depths.
+
+#define PAGES 256
+#define READS 500000
+#define ROUNDS 10
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double time_reads(char *buf) {
+    unsigned int seed = 1, val;
+    double start = now_ns();
+    for (int i = 0; i < READS; i++) {
+        seed = seed * 1103515245 + 12345;
+        get_value(buf + (seed >> 8) % PAGES * PGSIZE, &val, sizeof(int));
+    }
+    return (now_ns() - start) / READS;
+}
+
+double min(double a, double b) {
+    return a < b ? a : b;
+}
+
+int main() {
+    char *buf = t_malloc(PAGES * PGSIZE);
+    for (int p = 0; p < PAGES; p++)
+        put_value(buf + p * PGSIZE, &p, sizeof(int));
+
+    // The three cases take turns and each keeps its best round, so a slow
+    // stretch of the machine does not land on one of them only
+    double hit = 1e18, cached = 1e18, full = 1e18;
+    for (int r = 0; r < ROUNDS; r++) {
+        set_TLB_config(TLB_ENTRIES, TLB_DEFAULT_WAYS, TLB_LRU);
+        hit = min(hit, time_reads(buf));
+        set_TLB_config(1, 1, TLB_LRU);
+        cached = min(cached, time_reads(buf));
+        set_walk_cache(false);
+        full = min(full, time_reads(buf));
+        set_walk_cache(true);
+    }
+
+    printf("%d-level page table, %d byte pages\n", PT_LEVELS, PGSIZE);
+    printf("TLB hit read:                  %6.1f ns\n", hit);
+    printf("TLB miss read, walk cache:     %6.1f ns (walk %5.1f ns)\n", cached, cached - hit);
+    printf("TLB miss read, no walk cache:  %6.1f ns (walk %5.1f ns)\n", full, full - hit);
+    t_free(buf, PAGES * PGSIZE);
+    return 0;
+}
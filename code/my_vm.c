@@ -1,508 +1,6106 @@
-#include <math.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 #include "my_vm.h"
 
 // memory is page-addressed
-#define PHYSICAL_BITMAP_SIZE (MEMSIZE)
-#define VIRTUAL_BITMAP_SIZE (MAX_MEMSIZE / PGSIZE)
+#define NUM_FRAMES (MEMSIZE / PGSIZE)
+#define NUM_VIRTUAL_PAGES (MAX_MEMSIZE / PGSIZE)
 
-// Constants for page table/directory
-#define PAGE_TABLE_SIZE (PGSIZE / sizeof(pte_t))                         // number of entries that fit on a page
-#define PAGE_DIRECTORY_SIZE (pow(2, (log2(MAX_MEMSIZE) - log2(PGSIZE)))) // Page directory has an address for each table
+// Frame bitmap geometry: one bit per frame, 64 frames per word. Each summary
+// level keeps one bit per word of the level below, set while that word still
+// has a free frame, so the top level is a single word.
+#define BITMAP_WORD_BITS 64
+#define MAX_BITMAP_LEVELS 6
 
-// TLBEntry struct
-struct TLBEntry
+// Free virtual ranges are kept as extents on segregated lists, one per
+// power-of-two run length, and hashed by both ends for coalescing
+#define EXTENT_CLASSES 64
+#define EXTENT_HASH_BUCKETS 4096
+
+// Small requests are carved out of shared slab pages in power-of-two size
+// classes from SLAB_MIN_SIZE up to SLAB_MAX_SIZE
+#define SLAB_MIN_SHIFT 3
+#define SLAB_MIN_SIZE (1 << SLAB_MIN_SHIFT)
+#define SLAB_CLASSES (__builtin_ctz(SLAB_MAX_SIZE) - SLAB_MIN_SHIFT + 1)
+#define SLAB_NONE 0xFFFFFFFFU
+
+// Constants for page table/directory. A virtual address splits into
+// PD_BITS of index into the top level directory, PT_BITS of index for every
+// level below it and PGSHIFT of offset. Level 0 is the top, level
+// PT_LEVELS - 1 holds the page table entries.
+#define VA_BITS __builtin_ctzll(MAX_MEMSIZE)
+#define PAGE_TABLE_SIZE (PGSIZE / sizeof(pte_t)) // number of entries that fit on a page
+#define PT_BITS __builtin_ctzll(PAGE_TABLE_SIZE)
+#define PD_BITS (VA_BITS - (PT_LEVELS - 1) * PT_BITS - PGSHIFT)
+#define PAGE_DIRECTORY_SIZE (1UL << PD_BITS) // Page directory has an address for each table
+#define PD_FRAMES ((PAGE_DIRECTORY_SIZE * sizeof(pde_t) + PGSIZE - 1) / PGSIZE)
+
+// An entry one level above the page tables with PDE_LARGE set maps
+// LARGE_PAGE_SIZE bytes of contiguous frames itself instead of pointing to
+// a page table. t_malloc() uses large pages for every whole LARGE_PAGE_SIZE
+// piece of a request.
+#define PDE_LARGE 1UL
+#define PDE_COW 2UL // a large page shared with another address space
+#define PDE_FLAGS (PDE_LARGE | PDE_COW)
+#define LARGE_PAGE_FRAMES PAGE_TABLE_SIZE
+#define LARGE_PAGE_SIZE ((unsigned long)PGSIZE * LARGE_PAGE_FRAMES)
+
+// Large page translations get their own fully associative TLB
+#define LARGE_TLB_ENTRIES 32
+
+// Page walk cache: recent page table addresses per thread, direct mapped on
+// the region of virtual pages one page table covers
+#define WALK_CACHE_ENTRIES 16
+
+// Low bits of a page table entry, free because frames are page aligned. A
+// swapped out entry holds its swap slot above PGSHIFT instead of a frame,
+// slot 0 standing for a page that was never written.
+#define PTE_ACCESSED 0x2UL
+#define PTE_DIRTY 0x4UL
+#define PTE_BUSY 0x8UL // being swapped out or in
+#define PTE_SWAPPED 0x10UL
+#define PTE_GHOST 0x20UL // EVICT_2Q: left probation unused, comes back to the main queue
+#define PTE_AHEAD 0x40UL // read ahead and not touched since
+#define PTE_COW 0x80UL    // frame shared with another address space, copied on the first write
+#define PTE_WIRED 0x100UL // shared while not evictable, and stays so once copied
+#define PTE_FLAGS ((pte_t)(PGSIZE - 1))
+
+// Set in frame_pins once a frame t_pin() holds is unmapped and freed; the
+// last t_unpin() frees it then
+#define PIN_FREED 0x80000000U
+
+// translate_access() result for a page that has to be faulted in first
+#define PTE_FAULT ((pte_t)-2)
+
+// Low bit of a TLB frame, set once the page table entry is marked dirty
+#define TLB_DIRTY 1UL
+
+// Resident pages below which set_paging_config() refuses a limit
+#define MIN_RESIDENT_FRAMES 64
+
+// EVICT_LRU_APPROX ages this many frames to pick each victim
+#define AGING_BATCH 64
+
+// EVICT_2Q keeps at most 1 / TWOQ_IN_SHARE of its pages on probation
+#define TWOQ_IN_SHARE 4
+#define QUEUE_PROBATION 1
+#define QUEUE_MAIN 2
+#define QUEUE_END 0xFFFFFFFFU
+
+// Read-ahead: streams of faults tracked at once, pages kept read ahead of
+// a confirmed stream, and the largest stride in pages taken for one
+#define PREFETCH_STREAMS 8
+#define PREFETCH_DEPTH 32
+#define PREFETCH_MAX_STRIDE 64
+#define PREFETCH_QUEUE 256
+#define PREFETCH_BATCH 32 // pages the prefetch thread reads at a time
+
+// Dirty evicted pages held in memory until the write-back thread writes
+// them; it waits for a batch or at most WRITEBACK_DELAY_NS
+#define WRITEBACK_PAGES 256
+#define WRITEBACK_BATCH 32
+#define WRITEBACK_DELAY_NS 5000000L
+
+// Page merging: slots of the scanner's table of pages seen in a pass and
+// the slots tried per hash
+#define MERGE_TABLE_SIZE (1 << 16)
+#define MERGE_PROBES 8
+
+_Static_assert(PGSIZE >= 4096 && (PGSIZE & (PGSIZE - 1)) == 0, "PGSIZE must be a power of two of at least 4K");
+_Static_assert(PT_LEVELS >= 2 && PT_LEVELS <= 4, "PT_LEVELS must be 2, 3 or 4");
+_Static_assert(VA_BITS > (PT_LEVELS - 1) * PT_BITS + PGSHIFT, "PGSIZE is too large for the address space");
+_Static_assert(VA_BITS <= 8 * sizeof(void *), "the address space does not fit in a pointer");
+
+// Tag of an empty TLB way
+#define TLB_INVALID (~0ULL)
+
+// Runs of frames t_free() holds for after its TLB shootdown without a malloc()
+#define FREE_RUNS 64
+
+// Access tracing: entries in each thread's ring, a power of two, and how
+// often the flush thread empties the rings into the trace file
+#define TRACE_RING (1 << 18)
+#define TRACE_FLUSH_MS 5
+
+// Operation recording, see t_record_start(): the file magic and op codes of
+// the traces benchmark/bench_suite replays
+#define RECORD_MAGIC "VMTRACE1"
+#define RECORD_MALLOC 1
+#define RECORD_FREE 2
+#define RECORD_PUT 3
+#define RECORD_GET 4
+
+// Translations a t_readv/t_writev batch keeps for reuse across descriptors
+#define BATCH_HINTS 256
+
+// mat_mult() works on MAT_TILE x MAT_TILE blocks, keeping MAT_BLOCK columns
+// of a result row in four vector registers of MAT_LANES columns each
+#define MAT_TILE 64
+#ifdef __AVX2__
+#define MAT_LANES 8
+#else
+#define MAT_LANES 4
+#endif
+#define MAT_BLOCK (4 * MAT_LANES)
+
+// Most threads a parallel mat_mult() runs on, counting the caller
+#define MAT_MAX_THREADS 64
+
+// Shootdowns remembered for threads catching up; a thread further behind
+// than this flushes its whole TLB instead
+#define SHOOTDOWN_LOG_SIZE 64
+
+/*
+Set-associative TLB keyed on virtual page number. Every thread owns one, so
+lookups touch no shared state besides the shootdown generation. Each array
+is laid out set by set, so the tags of one set are packed next to each other
+for the vectorized compare in tlb_lookup().
+*/
+struct TLB
+{
+    unsigned int sets;
+    unsigned int ways;
+    enum tlb_policy policy;
+    uint64_t *tags;        // virtual page number per way, TLB_INVALID when empty
+    unsigned long *frames; // physical address of the page per way
+    uint64_t *stamps;      // TLB_LRU: tick of the last use per way
+    uint8_t *plru;         // TLB_PLRU: tree bits per set, node 1 is the root
+    uint8_t *referenced;   // TLB_CLOCK: reference bit per way
+    unsigned int *hands;   // TLB_CLOCK: hand per set
+    uint64_t tick;
+    uint64_t seed;              // TLB_RANDOM: xorshift state
+    uint64_t large_tags[LARGE_TLB_ENTRIES];       // large page number, TLB_INVALID when empty
+    unsigned long large_frames[LARGE_TLB_ENTRIES]; // physical address of the large page
+    uint64_t large_stamps[LARGE_TLB_ENTRIES];     // tick of the last use, for LRU
+    uint64_t walk_tags[WALK_CACHE_ENTRIES];       // region (vpn >> PT_BITS), TLB_INVALID when empty
+    pde_t walk_tables[WALK_CACHE_ENTRIES];        // page table covering the region
+    pde_t walk_root;                              // directory the cached walks started from
+    struct address_space *space;                  // address space the entries translate for
+    unsigned long generation;   // last shootdown applied
+    unsigned long access_gen;   // generation + 1 while copying to or from frames, else 0
+    unsigned long config;       // tlb_config_version it was built with
+    unsigned long hits;         // only written by the owning thread
+    unsigned long misses;
+    struct TLB *next;           // all live TLBs, for aggregating counters
+};
+
+#ifndef VM_NO_STATS
+// A thread's counters for t_vm_stats(), on cache lines no other thread writes
+struct thread_stats
+{
+    struct vm_stats s;
+    unsigned int until_sample[VM_OPS]; // calls of each operation before the next timed one
+    struct thread_stats *next;         // all live threads' counters
+} __attribute__((aligned(64)));
+#endif
+
+/*
+A thread's traced accesses on their way to the trace file. Only the thread
+writes entries and moves head, only the flush thread moves tail.
+*/
+struct trace_ring
+{
+    uint64_t entries[TRACE_RING]; // vpn << 1, plus 1 for a write
+    unsigned long head;           // entries written so far
+    unsigned long tail;           // entries written to the file so far
+    unsigned int thread;          // the thread's number in the trace
+    bool retired;                 // the thread exited, free once empty
+    struct trace_ring *next;
+};
+
+// An allocation live while operations are recorded, and its id in the file
+struct recorded
+{
+    unsigned long va;
+    unsigned long size;
+    unsigned long id;
+};
+
+// A page translated earlier in the same copy or batch
+struct page_hint
 {
-    unsigned long virtual_page;
-    unsigned long physical_page;
     bool valid;
+    unsigned long vpn;
+    pte_t pa;                 // physical address of the page
+    unsigned long generation; // TLB generation it was translated in
+};
+
+// Faults a constant number of virtual pages apart in one address space
+struct fault_stream
+{
+    struct address_space *space;
+    unsigned long last;  // latest page of the stream touched
+    long stride;         // pages between touches, 0 until the second one
+    unsigned long next;  // next page to read ahead
+    unsigned int hits;   // touches that kept the stride
+    unsigned long stamp; // last use, 0 for an empty stream
+};
+
+// A page to read ahead, NULL space once the space is gone
+struct prefetch_request
+{
+    struct address_space *space;
+    unsigned long vpn;
+};
+
+// A page seen in the current merge pass, NULL space for an empty slot
+struct merge_candidate
+{
+    uint64_t hash;
+    struct address_space *space;
+    unsigned long vpn;
+};
+
+// A page the merge scanner works on, pte being its entry when looked at
+struct merge_page
+{
+    struct address_space *space;
+    pde_t table;
+    unsigned long index;
+    unsigned long vpn;
+    pte_t pte;
+};
+
+// A swapped out page claimed for reading back into the frame at pa
+struct swap_in
+{
+    struct address_space *space;
+    pde_t table;
+    unsigned long index;
+    unsigned long vpn;
+    pte_t pte; // the entry before it was marked busy
+    long pa;
+};
+
+// A dirty page copied out of its frame on eviction, waiting to be written
+struct writeback
+{
+    unsigned long slot; // swap slot, 0 while the entry is free
+    char *page;         // copy of the page
+    bool writing;       // taken by the write-back thread
+    bool dropped;       // slot freed while it was being written
+};
+
+// A range of virtual pages whose translations were invalidated
+struct shootdown
+{
+    unsigned long start;
+    unsigned long pages;
+};
+
+// A row segment of MAT_LANES unsigned ints for the mat_mult() kernel
+typedef unsigned int mat_vec __attribute__((vector_size(MAT_LANES * sizeof(unsigned int))));
+
+/*
+Tasks of the running mat_mult() phase still to be claimed by one worker.
+Its owner takes them from the front and, once it runs dry, steals from the
+other workers' queues the same way, so a task index is handed out by
+exactly one fetch-and-add. Each queue fills its own cache line.
+*/
+struct mat_queue
+{
+    unsigned long next;
+    unsigned long end;
+} __attribute__((aligned(64)));
+
+// The multiply the worker pool is running and the phase it is in
+struct mat_job
+{
+    void (*run)(struct mat_job *job, unsigned long task);
+    struct address_space *space;      // of the caller, whose operands these are
+    unsigned long mat1, mat2, answer; // virtual addresses of the operands
+    unsigned int *a, *b, *c;          // host copies of the operands
+    int size;
+    int tiles; // tiles along one side
+};
+
+// Frames unmapped by t_free(): a run of data frames, or with no frames a
+// page table at level and the tables below it
+struct free_run
+{
+    long pa;
+    unsigned long frames;
+    int level;
+};
+
+// Packs four tags for a single vector compare
+typedef uint64_t tlb_tag_vec __attribute__((vector_size(4 * sizeof(uint64_t))));
+
+// A run of free virtual pages
+struct extent
+{
+    unsigned long start; // first free virtual page
+    unsigned long pages; // length of the run
+    struct extent *prev; // neighbours on the size class list
+    struct extent *next;
+    struct extent *start_chain; // hash chain keyed on start
+    struct extent *end_chain;   // hash chain keyed on start + pages
+};
+
+/*
+An address space: a page directory, the free runs of its virtual pages and
+its partial slabs. Slab headers live in the slab pages themselves, so they
+are per space too.
+*/
+struct address_space
+{
+    int id;          // index in spaces
+    pde_t directory; // PD_FRAMES contiguous frames
+    struct extent *extent_classes[EXTENT_CLASSES]; // class i holds runs of [2^i, 2^(i+1)) pages
+    uint64_t extent_class_mask;                    // bit i set while class i is non-empty
+    struct extent *extents_by_start[EXTENT_HASH_BUCKETS];
+    struct extent *extents_by_end[EXTENT_HASH_BUCKETS];
+    unsigned long slab_partial[SLAB_CLASSES]; // first slab with a free slot per class, 0 if none
+    unsigned long slab_spare[SLAB_CLASSES];   // an empty slab kept on the partial list per class, 0 if none
+};
+
+/*
+Bookkeeping for a slab page, stored in its last bytes inside physical memory.
+Slots below the header are handed out from free_head first, then by bumping.
+Each free slot holds the offset of the next one in its first bytes.
+*/
+struct slab_header
+{
+    unsigned long prev;     // virtual address of the previous partial slab
+    unsigned long next;     // virtual address of the next partial slab
+    unsigned int free_head; // offset of the first recycled slot, or SLAB_NONE
+    unsigned int bump;      // offset of the first never used slot
+    unsigned int used;      // slots currently handed out
 };
 
 // Global sizes
-int page_dir_off;
-int page_tbl_off;
-int page_off;
-pde_t directory_start;
+pthread_once_t vm_once = PTHREAD_ONCE_INIT;
+
+// Address spaces: the initial one, space 0, and those made by t_clone()
+struct address_space initial_space;
+struct address_space *spaces[MAX_SPACES] = {&initial_space};
+__thread struct address_space *thread_space; // NULL for the initial space
+pthread_mutex_t space_lock = PTHREAD_MUTEX_INITIALIZER; // spaces, cloning and copying large pages
 
 // Global variables to store the physical and virtual pages and memory
-char *physical_bitmap;
-char *virtual_bitmap;
+// physical_bitmap[0] has a set bit for every free frame, higher levels summarize
+uint64_t *physical_bitmap[MAX_BITMAP_LEVELS];
+unsigned long bitmap_words[MAX_BITMAP_LEVELS];
+int bitmap_levels;
+unsigned long frame_cursor; // rotating start point for the next frame search
+unsigned long large_cursor; // first frame of the next large page candidate
+bool large_pages_enabled = true;
+bool walk_cache_enabled = true;
+struct extent *spare_extents; // recycled extent nodes
 char *physical_memory;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Allocator metadata has its own locks; page table walks take none
+pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t extent_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t slab_locks[SLAB_CLASSES];
+
+/*
+Demand paging. frame_owner has vpn + 1 of the page in each frame that may
+be evicted and 0 for page tables, slab pages, large pages and frames shared
+between address spaces; frame_slot the
+swap slot still holding a clean copy of that page, if any. Both belong to
+whoever holds the page's entry busy or is the one clearing it.
+*/
+unsigned long frame_limit = NUM_FRAMES; // frames in use before pages get evicted
+unsigned long frames_in_use;            // under frame_lock
+unsigned long *frame_owner;
+uint8_t *frame_space; // address space of the page in frame_owner
+unsigned long *frame_slot;
+unsigned int *frame_shares; // other entries mapping the frame, the first one of a large page
+unsigned int *frame_pins;   // t_pin() holds on the frame, plus PIN_FREED
+unsigned long evictable_frames;
+enum evict_policy evict_policy = EVICT_CLOCK;
+unsigned long evict_hand;             // EVICT_CLOCK and EVICT_LRU_APPROX scan position
+uint8_t *frame_age;                   // EVICT_LRU_APPROX aging counter per frame
+uint8_t *frame_queue;                 // EVICT_2Q list a frame is on, 0 if none
+unsigned int *queue_prev, *queue_next; // EVICT_2Q list links by frame number
+unsigned int queue_head[3] = {QUEUE_END, QUEUE_END, QUEUE_END};
+unsigned int queue_tail[3] = {QUEUE_END, QUEUE_END, QUEUE_END};
+unsigned long queue_length[3];
+unsigned long paging_faults, paging_prefetched, paging_evictions, paging_writebacks, paging_stall_ns;
+pthread_mutex_t evict_lock = PTHREAD_MUTEX_INITIALIZER; // victim choice and the lists
+
+// Swap file, opened when the first page is written out. Slots count from 1.
+int swap_fd = -1;
+char *swap_file; // NULL for an unlinked temporary file
+unsigned long swap_next_slot = 1;
+unsigned long *swap_free; // released slots
+unsigned long swap_free_count;
+unsigned long swap_free_size;
+pthread_mutex_t swap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Background I/O: a thread reading detected fault streams ahead and one
+// writing evicted dirty pages in batches, both started on first use
+pthread_once_t io_once = PTHREAD_ONCE_INIT;
+bool prefetch_enabled = true;
+struct fault_stream fault_streams[PREFETCH_STREAMS];
+unsigned long stream_clock;
+struct prefetch_request prefetch_queue[PREFETCH_QUEUE]; // pages to read, a ring
+unsigned long prefetch_head, prefetch_tail;             // tail - head are queued
+pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t prefetch_run_lock = PTHREAD_MUTEX_INITIALIZER; // held while a batch is read
+pthread_cond_t prefetch_wake = PTHREAD_COND_INITIALIZER;
+struct writeback writebacks[WRITEBACK_PAGES];
+unsigned long writeback_used;   // entries holding a page
+unsigned long writeback_queued; // of those, not taken by the thread yet
+bool writeback_full;            // an evictor waits for a free entry
+pthread_mutex_t writeback_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t writeback_wake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t writeback_done = PTHREAD_COND_INITIALIZER;
+
+/*
+Sharing identical pages. Evictable pages are mapped to zero_page, never
+freed and not counted in frame_shares, until they are first written. The
+merge scanner, started by set_merge_config(), hashes a few pages per round
+and maps pages whose contents match, and did not change since its previous
+pass, to one frame copy on write. A round holds merge_lock, which
+t_destroy() takes to keep it off a space going away.
+*/
+long zero_page = -1;
+uint64_t zero_hash;
+unsigned long zero_mappings; // entries mapping zero_page
+unsigned long shared_frames; // frames that entries sharing with another would take on their own
+uint32_t *frame_hash;        // low bits of each frame's hash when the scanner last saw it
+struct merge_candidate merge_table[MERGE_TABLE_SIZE];
+unsigned int merge_space;  // where the scanner goes on, a space id
+unsigned long merge_vpn;   // and a page in it
+unsigned int merge_pages;  // pages looked at per round, 0 while stopped
+unsigned int merge_interval_ms;
+bool merge_started;
+unsigned long merge_merged, merge_scanned, merge_scan_ns;
+pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t merge_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t merge_wake = PTHREAD_COND_INITIALIZER;
+
+// Worker pool for parallel mat_mult(); one parallel multiply runs at a time
+// and its caller works as worker 0
+int mat_threads = 1;
+int mat_pool_size = 1; // caller plus helper threads started so far
+pthread_t mat_workers[MAT_MAX_THREADS];
+struct mat_queue mat_queues[MAT_MAX_THREADS];
+struct mat_job *mat_current;
+unsigned long mat_round; // bumped to start every phase
+int mat_round_workers;   // workers taking part in the current phase
+int mat_active;          // helpers not done with the current phase
+pthread_mutex_t mat_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t mat_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t mat_wake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t mat_done = PTHREAD_COND_INITIALIZER;
 
 // Global TLB variables
 // Structure to represents TLB
-struct TLBEntry *tlb_entries;
-double TLB_misses;
-double TLB_hits;
+__thread struct TLB *thread_tlb;
+unsigned int tlb_config_entries = TLB_ENTRIES;
+unsigned int tlb_config_ways = TLB_DEFAULT_WAYS;
+enum tlb_policy tlb_config_policy = TLB_LRU;
+unsigned long tlb_config_version;
+
+// Registry of live TLBs, plus the counters of threads that already exited
+struct TLB *all_tlbs;
+unsigned long retired_hits;
+unsigned long retired_misses;
+pthread_mutex_t tlb_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t tlb_key;
+pthread_once_t tlb_key_once = PTHREAD_ONCE_INIT;
+
+#ifndef VM_NO_STATS
+// Registry of every thread's counters, plus the totals of threads that
+// already exited
+__thread struct thread_stats *thread_counters;
+struct thread_stats *all_stats;
+struct vm_stats retired_stats;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t stats_key;
+pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+// Periodic JSON dumps of t_vm_stats(), appended to stats_path
+char *stats_path;
+unsigned int stats_interval_ms; // 0 while stopped
+bool stats_started;
+pthread_mutex_t stats_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t stats_wake = PTHREAD_COND_INITIALIZER;
+
+// Access tracing, see t_trace_start(). trace_lock covers the ring list
+// and the file; the rings themselves are lock free.
+bool trace_on;
+FILE *trace_file;
+__thread struct trace_ring *thread_ring;
+struct trace_ring *all_rings;
+unsigned int trace_threads; // numbers given to threads so far
+bool trace_started;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t trace_wake = PTHREAD_COND_INITIALIZER;
+pthread_key_t trace_key;
+pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+// Operation recording, see t_record_start(). record_lock covers the file
+// and the allocations, which are kept sorted by address.
+bool record_on;
+FILE *record_file;
+struct address_space *record_space; // the space recorded, as clones reuse addresses
+struct recorded *record_live;
+unsigned long record_count, record_capacity;
+unsigned long *record_free_ids; // ids of freed allocations, for reuse
+unsigned long record_free_count, record_free_capacity;
+unsigned long record_next_id;
+__thread bool record_nested; // inside t_realloc(), whose own calls are not recorded
+pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Shootdown log: entry g % SHOOTDOWN_LOG_SIZE describes the invalidation that
+// moved tlb_generation from g to g + 1
+struct shootdown shootdown_log[SHOOTDOWN_LOG_SIZE];
+unsigned long tlb_generation;
+pthread_mutex_t shootdown_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifndef VM_NO_STATS
+static unsigned long monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+// Thread exit: fold the counters into the totals
+static void retire_stats(void *arg)
+{
+    struct thread_stats *st = (struct thread_stats *)arg;
+    struct vm_stats *total = &retired_stats;
+
+    pthread_mutex_lock(&stats_lock);
+    struct thread_stats **link = &all_stats;
+    while (*link != st)
+    {
+        link = &(*link)->next;
+    }
+    *link = st->next;
+    total->tlb_hits += st->s.tlb_hits;
+    total->tlb_misses += st->s.tlb_misses;
+    total->page_walks += st->s.page_walks;
+    total->frames_allocated += st->s.frames_allocated;
+    total->frames_freed += st->s.frames_freed;
+    total->tables_allocated += st->s.tables_allocated;
+    total->tables_freed += st->s.tables_freed;
+    total->lock_waits += st->s.lock_waits;
+    total->lock_wait_ns += st->s.lock_wait_ns;
+    for (int op = 0; op < VM_OPS; op++)
+    {
+        struct vm_histogram *hist = &total->latency[op];
+        total->calls[op] += st->s.calls[op];
+        hist->count += st->s.latency[op].count;
+        hist->sum_ns += st->s.latency[op].sum_ns;
+        if (st->s.latency[op].max_ns > hist->max_ns)
+        {
+            hist->max_ns = st->s.latency[op].max_ns;
+        }
+        for (int b = 0; b < VM_HIST_BUCKETS; b++)
+        {
+            hist->buckets[b] += st->s.latency[op].buckets[b];
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    thread_counters = NULL;
+    free(st);
+}
+
+static void create_stats_key()
+{
+    pthread_key_create(&stats_key, retire_stats);
+}
+
+// Creates and registers the calling thread's counters
+static struct thread_stats *new_stats()
+{
+    pthread_once(&stats_key_once, create_stats_key);
+    struct thread_stats *st;
+    if (posix_memalign((void **)&st, __alignof__(struct thread_stats), sizeof(struct thread_stats)) != 0)
+    {
+        perror("Failed to allocate statistics");
+        exit(1);
+    }
+    memset(st, 0, sizeof(struct thread_stats));
+
+    pthread_mutex_lock(&stats_lock);
+    st->next = all_stats;
+    all_stats = st;
+    pthread_mutex_unlock(&stats_lock);
+    pthread_setspecific(stats_key, st);
+    thread_counters = st;
+    return st;
+}
+
+static inline struct thread_stats *my_stats()
+{
+    struct thread_stats *st = thread_counters;
+    return st != NULL ? st : new_stats();
+}
+
+// Counter update visible to t_vm_stats() from other threads
+static inline void count_stat(unsigned long *counter, unsigned long n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+#define STAT_ADD(field, n) count_stat(&my_stats()->s.field, (n))
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
 
 /*
-Function responsible for allocating and setting your physical memory
-@Author - Advith
+Locks m. When another thread holds it, the time spent blocked goes to the
+calling thread's lock wait counters.
+*/
+static void lock_mutex(pthread_mutex_t *m)
+{
+#ifndef VM_NO_STATS
+    if (pthread_mutex_trylock(m) == 0)
+    {
+        return;
+    }
+    unsigned long start = monotonic_ns();
+    pthread_mutex_lock(m);
+    STAT_ADD(lock_wait_ns, monotonic_ns() - start);
+    STAT_ADD(lock_waits, 1);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+// Lowest latency that falls in bucket
+static unsigned long bucket_floor(unsigned int bucket)
+{
+    if (bucket < VM_HIST_SUB)
+    {
+        return bucket;
+    }
+    unsigned int shift = __builtin_ctz(VM_HIST_SUB);
+    unsigned int top = bucket / VM_HIST_SUB + shift - 1;
+    return (unsigned long)(VM_HIST_SUB + bucket % VM_HIST_SUB) << (top - shift);
+}
+
+#ifndef VM_NO_STATS
+// Histogram bucket of a latency: exact below VM_HIST_SUB, then VM_HIST_SUB per power of two
+static unsigned int hist_bucket(unsigned long ns)
+{
+    if (ns < VM_HIST_SUB)
+    {
+        return ns;
+    }
+    unsigned int shift = __builtin_ctz(VM_HIST_SUB);
+    unsigned int top = 63 - __builtin_clzl(ns);
+    unsigned long bucket = (top - shift + 1) * VM_HIST_SUB + ((ns >> (top - shift)) & (VM_HIST_SUB - 1));
+    return bucket < VM_HIST_BUCKETS ? bucket : VM_HIST_BUCKETS - 1;
+}
+
+/*
+Counts a call of op and returns its start time when it is the one in
+VM_STATS_SAMPLE to be timed, or 0.
+*/
+static inline unsigned long op_begin(enum vm_op op)
+{
+    struct thread_stats *st = my_stats();
+    count_stat(&st->s.calls[op], 1);
+    if (st->until_sample[op] > 0)
+    {
+        st->until_sample[op]--;
+        return 0;
+    }
+    st->until_sample[op] = VM_STATS_SAMPLE - 1;
+    return monotonic_ns();
+}
+
+// Adds the latency of a timed call of op to its histogram
+static inline void op_end(enum vm_op op, unsigned long start)
+{
+    if (start == 0)
+    {
+        return;
+    }
+    unsigned long ns = monotonic_ns() - start;
+    struct vm_histogram *hist = &my_stats()->s.latency[op];
+    count_stat(&hist->count, 1);
+    count_stat(&hist->sum_ns, ns);
+    count_stat(&hist->buckets[hist_bucket(ns)], 1);
+    if (ns > hist->max_ns)
+    {
+        __atomic_store_n(&hist->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+#else
+#define op_begin(op) 0UL
+#define op_end(op, start) ((void)(start))
+#endif
+
+// The address space the calling thread works in, see t_switch()
+static struct address_space *current_space()
+{
+    return thread_space != NULL ? thread_space : &initial_space;
+}
+
+/*
+Builds the frame bitmap levels with every frame marked free. Bits past the
+last frame are left clear so searches never hand them out.
+*/
+static void init_frame_bitmap()
+{
+    unsigned long bits = NUM_FRAMES;
+    bitmap_levels = 0;
+    do
+    {
+        unsigned long words = (bits + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+        uint64_t *level = (uint64_t *)malloc(sizeof(uint64_t) * words);
+        if (level == NULL)
+        {
+            perror("Failed to allocate bitmaps");
+            exit(1);
+        }
+        for (unsigned long i = 0; i < words; i++)
+        {
+            unsigned long left = bits - i * BITMAP_WORD_BITS;
+            level[i] = left >= BITMAP_WORD_BITS ? ~0ULL : (1ULL << left) - 1;
+        }
+        physical_bitmap[bitmap_levels] = level;
+        bitmap_words[bitmap_levels] = words;
+        bitmap_levels++;
+        bits = words;
+    } while (bits > 1);
+    frame_cursor = 0;
+}
+
+/*
+Returns the first free frame at or after start, or -1 if there is none. Climbs
+the summary levels until a word with a set bit past the search point shows
+up, then descends taking the lowest set bit at each level.
+*/
+static long find_free_frame(unsigned long start)
+{
+    unsigned long idx = start;
+    int level = 0;
+    while (level < bitmap_levels)
+    {
+        unsigned long word = idx / BITMAP_WORD_BITS;
+        if (word >= bitmap_words[level])
+        {
+            return -1;
+        }
+        uint64_t bits = physical_bitmap[level][word] & (~0ULL << (idx % BITMAP_WORD_BITS));
+        if (bits != 0)
+        {
+            idx = word * BITMAP_WORD_BITS + __builtin_ctzll(bits);
+            break;
+        }
+        idx = word + 1;
+        level++;
+    }
+    if (level == bitmap_levels)
+    {
+        return -1;
+    }
+    while (level > 0)
+    {
+        level--;
+        idx = idx * BITMAP_WORD_BITS + __builtin_ctzll(physical_bitmap[level][idx]);
+    }
+    return idx;
+}
+
+// Marks a frame used, clearing summary bits for words that became full
+static void mark_frame_used(unsigned long frame)
+{
+    for (int level = 0; level < bitmap_levels; level++)
+    {
+        uint64_t *word = &physical_bitmap[level][frame / BITMAP_WORD_BITS];
+        *word &= ~(1ULL << (frame % BITMAP_WORD_BITS));
+        if (*word != 0)
+        {
+            break;
+        }
+        frame /= BITMAP_WORD_BITS;
+    }
+}
+
+// Marks a frame free, setting summary bits for words that were full
+static void mark_frame_free(unsigned long frame)
+{
+    for (int level = 0; level < bitmap_levels; level++)
+    {
+        uint64_t *word = &physical_bitmap[level][frame / BITMAP_WORD_BITS];
+        bool was_full = (*word == 0);
+        *word |= 1ULL << (frame % BITMAP_WORD_BITS);
+        if (!was_full)
+        {
+            break;
+        }
+        frame /= BITMAP_WORD_BITS;
+    }
+}
+
+// Bits of a bitmap word starting a free aligned block of size frames, at most a word
+static uint64_t free_block_starts(uint64_t bits, unsigned long size)
+{
+    for (unsigned long shift = 1; shift < size; shift *= 2)
+    {
+        bits &= bits >> shift;
+    }
+    return bits & (size == BITMAP_WORD_BITS ? 1 : ~0ULL / ((1ULL << size) - 1));
+}
+
+static int extent_class(unsigned long pages)
+{
+    return 63 - __builtin_clzll(pages);
+}
+
+static unsigned long extent_hash(unsigned long page)
+{
+    return (page * 0x9E3779B97F4A7C15ULL) >> 32 & (EXTENT_HASH_BUCKETS - 1);
+}
+
+// Adds a free run to its size class list and both hash tables
+static void insert_extent(struct address_space *as, unsigned long start, unsigned long pages)
+{
+    struct extent *e = spare_extents;
+    if (e != NULL)
+    {
+        spare_extents = e->next;
+    }
+    else if ((e = (struct extent *)malloc(sizeof(struct extent))) == NULL)
+    {
+        perror("Failed to allocate extent");
+        exit(1);
+    }
+    e->start = start;
+    e->pages = pages;
+
+    int cls = extent_class(pages);
+    e->prev = NULL;
+    e->next = as->extent_classes[cls];
+    if (e->next != NULL)
+    {
+        e->next->prev = e;
+    }
+    as->extent_classes[cls] = e;
+    as->extent_class_mask |= 1ULL << cls;
+
+    unsigned long sb = extent_hash(start);
+    unsigned long eb = extent_hash(start + pages);
+    e->start_chain = as->extents_by_start[sb];
+    as->extents_by_start[sb] = e;
+    e->end_chain = as->extents_by_end[eb];
+    as->extents_by_end[eb] = e;
+}
+
+// Unlinks an extent from every index and recycles the node
+static void remove_extent(struct address_space *as, struct extent *e)
+{
+    int cls = extent_class(e->pages);
+    if (e->prev != NULL)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        as->extent_classes[cls] = e->next;
+        if (e->next == NULL)
+        {
+            as->extent_class_mask &= ~(1ULL << cls);
+        }
+    }
+    if (e->next != NULL)
+    {
+        e->next->prev = e->prev;
+    }
+
+    struct extent **link = &as->extents_by_start[extent_hash(e->start)];
+    while (*link != e)
+    {
+        link = &(*link)->start_chain;
+    }
+    *link = e->start_chain;
+    link = &as->extents_by_end[extent_hash(e->start + e->pages)];
+    while (*link != e)
+    {
+        link = &(*link)->end_chain;
+    }
+    *link = e->end_chain;
+
+    e->next = spare_extents;
+    spare_extents = e;
+}
+
+// Returns the free extent that begins at page, if any
+static struct extent *extent_starting_at(struct address_space *as, unsigned long page)
+{
+    struct extent *e = as->extents_by_start[extent_hash(page)];
+    while (e != NULL && e->start != page)
+    {
+        e = e->start_chain;
+    }
+    return e;
+}
+
+// Returns the free extent that ends just before page, if any
+static struct extent *extent_ending_at(struct address_space *as, unsigned long page)
+{
+    struct extent *e = as->extents_by_end[extent_hash(page)];
+    while (e != NULL && e->start + e->pages != page)
+    {
+        e = e->end_chain;
+    }
+    return e;
+}
+
+/*
+Gives a run of virtual pages back to the free extents of as, merging it
+with the free runs directly before and after it, and returns the extent
+holding it now. The caller holds extent_lock.
+*/
+static struct extent *release_extent(struct address_space *as, unsigned long start, unsigned long pages)
+{
+    struct extent *before = extent_ending_at(as, start);
+    if (before != NULL)
+    {
+        start = before->start;
+        pages += before->pages;
+        remove_extent(as, before);
+    }
+    struct extent *after = extent_starting_at(as, start + pages);
+    if (after != NULL)
+    {
+        pages += after->pages;
+        remove_extent(as, after);
+    }
+    insert_extent(as, start, pages);
+    return extent_starting_at(as, start);
+}
+
+// Gives a run of virtual pages back to the calling thread's address space
+void release_virtual(unsigned long start, unsigned long pages)
+{
+    lock_mutex(&extent_lock);
+    release_extent(current_space(), start, pages);
+    pthread_mutex_unlock(&extent_lock);
+}
+
+/*
+Allocates an empty TLB with the configured geometry, replacing the arrays
+of a previous one, and clears its hit and miss counters.
+*/
+static void init_TLB(struct TLB *t)
+{
+    unsigned int entries = tlb_config_entries;
+
+    free(t->tags);
+    free(t->frames);
+    free(t->stamps);
+    free(t->plru);
+    free(t->referenced);
+    free(t->hands);
+
+    t->config = tlb_config_version;
+    t->ways = tlb_config_ways;
+    t->sets = entries / t->ways;
+    t->policy = tlb_config_policy;
+    t->tags = (uint64_t *)malloc(sizeof(uint64_t) * entries);
+    t->frames = (unsigned long *)calloc(entries, sizeof(unsigned long));
+    t->stamps = (uint64_t *)calloc(entries, sizeof(uint64_t));
+    t->plru = (uint8_t *)calloc(entries, sizeof(uint8_t));
+    t->referenced = (uint8_t *)calloc(entries, sizeof(uint8_t));
+    t->hands = (unsigned int *)calloc(t->sets, sizeof(unsigned int));
+    if (t->tags == NULL || t->frames == NULL || t->stamps == NULL || t->plru == NULL ||
+        t->referenced == NULL || t->hands == NULL)
+    {
+        perror("Failed to allocate TLB");
+        exit(1);
+    }
+    for (unsigned int i = 0; i < entries; i++)
+    {
+        t->tags[i] = TLB_INVALID; // no mapping when the entries are empty
+    }
+    for (unsigned int i = 0; i < LARGE_TLB_ENTRIES; i++)
+    {
+        t->large_tags[i] = TLB_INVALID;
+    }
+    for (unsigned int i = 0; i < WALK_CACHE_ENTRIES; i++)
+    {
+        t->walk_tags[i] = TLB_INVALID;
+    }
+    t->tick = 0;
+    t->seed = 0x9E3779B97F4A7C15ULL;
+    __atomic_store_n(&t->hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->misses, 0, __ATOMIC_RELAXED);
+}
+
+// Thread exit: keep the counters, drop the TLB
+static void retire_TLB(void *arg)
+{
+    struct TLB *t = (struct TLB *)arg;
+
+    lock_mutex(&tlb_registry_lock);
+    struct TLB **link = &all_tlbs;
+    while (*link != t)
+    {
+        link = &(*link)->next;
+    }
+    *link = t->next;
+    retired_hits += t->hits;
+    retired_misses += t->misses;
+    pthread_mutex_unlock(&tlb_registry_lock);
+
+    free(t->tags);
+    free(t->frames);
+    free(t->stamps);
+    free(t->plru);
+    free(t->referenced);
+    free(t->hands);
+    free(t);
+}
+
+static void create_tlb_key()
+{
+    pthread_key_create(&tlb_key, retire_TLB);
+}
+
+static void flush_TLB(struct TLB *t)
+{
+    unsigned int entries = t->sets * t->ways;
+    for (unsigned int i = 0; i < entries; i++)
+    {
+        t->tags[i] = TLB_INVALID;
+        t->referenced[i] = 0;
+    }
+    for (unsigned int i = 0; i < LARGE_TLB_ENTRIES; i++)
+    {
+        t->large_tags[i] = TLB_INVALID;
+    }
+    for (unsigned int i = 0; i < WALK_CACHE_ENTRIES; i++)
+    {
+        t->walk_tags[i] = TLB_INVALID;
+    }
+}
+
+// Flushes t when it last held translations of another address space than as
+static void tag_TLB(struct TLB *t, struct address_space *as)
+{
+    if (t->space != as)
+    {
+        flush_TLB(t);
+        t->space = as;
+    }
+}
+
+static int tlb_lookup(struct TLB *t, unsigned long set, uint64_t vpn);
+static void add_large_TLB(struct address_space *as, unsigned long lpn, unsigned long pa);
+
+static void invalidate_TLB_range(struct TLB *t, unsigned long start, unsigned long pages)
+{
+    if (pages >= t->sets * t->ways)
+    {
+        flush_TLB(t);
+        return;
+    }
+    for (unsigned int i = 0; i < WALK_CACHE_ENTRIES; i++)
+    {
+        unsigned long first = t->walk_tags[i] * PAGE_TABLE_SIZE;
+        if (t->walk_tags[i] != TLB_INVALID && first < start + pages && start < first + PAGE_TABLE_SIZE)
+        {
+            t->walk_tags[i] = TLB_INVALID;
+        }
+    }
+    for (unsigned int i = 0; i < LARGE_TLB_ENTRIES; i++)
+    {
+        unsigned long first = t->large_tags[i] * LARGE_PAGE_FRAMES;
+        if (t->large_tags[i] != TLB_INVALID && first < start + pages && start < first + LARGE_PAGE_FRAMES)
+        {
+            t->large_tags[i] = TLB_INVALID;
+        }
+    }
+    for (unsigned long vpn = start; vpn < start + pages; vpn++)
+    {
+        unsigned long set = vpn & (t->sets - 1);
+        int way = tlb_lookup(t, set, vpn);
+        if (way >= 0)
+        {
+            t->tags[set * t->ways + way] = TLB_INVALID;
+            t->referenced[set * t->ways + way] = 0;
+        }
+    }
+}
+
+/*
+Brings a TLB up to date with the shootdowns published since it last looked,
+replaying the logged ranges or flushing everything when it fell too far
+behind. A log entry overwritten while it was being read shows up as the
+generation having moved a full log length past ours.
+*/
+static void sync_TLB(struct TLB *t, unsigned long generation)
+{
+    if (generation - t->generation >= SHOOTDOWN_LOG_SIZE)
+    {
+        flush_TLB(t);
+    }
+    else
+    {
+        for (unsigned long g = t->generation; g != generation; g++)
+        {
+            struct shootdown *entry = &shootdown_log[g % SHOOTDOWN_LOG_SIZE];
+            unsigned long start = __atomic_load_n(&entry->start, __ATOMIC_RELAXED);
+            unsigned long pages = __atomic_load_n(&entry->pages, __ATOMIC_RELAXED);
+            invalidate_TLB_range(t, start, pages);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&tlb_generation, __ATOMIC_RELAXED) - t->generation >= SHOOTDOWN_LOG_SIZE)
+        {
+            flush_TLB(t);
+        }
+    }
+    t->generation = generation;
+}
+
+/*
+Returns the calling thread's TLB, creating it on first use and applying any
+pending shootdowns or configuration change.
+*/
+static struct TLB *get_TLB()
+{
+    struct TLB *t = thread_tlb;
+    if (t == NULL)
+    {
+        pthread_once(&tlb_key_once, create_tlb_key);
+        t = (struct TLB *)calloc(1, sizeof(struct TLB));
+        if (t == NULL)
+        {
+            perror("Failed to allocate TLB");
+            exit(1);
+        }
+        init_TLB(t);
+        t->generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+
+        lock_mutex(&tlb_registry_lock);
+        t->next = all_tlbs;
+        all_tlbs = t;
+        pthread_mutex_unlock(&tlb_registry_lock);
+        pthread_setspecific(tlb_key, t);
+        thread_tlb = t;
+        return t;
+    }
+
+    if (__atomic_load_n(&tlb_config_version, __ATOMIC_RELAXED) != t->config)
+    {
+        init_TLB(t);
+        t->generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+        return t;
+    }
+    unsigned long generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+    if (generation != t->generation)
+    {
+        sync_TLB(t, generation);
+    }
+    return t;
+}
+
+/*
+Invalidates the translations of a range of virtual pages in every thread's
+TLB: the caller's at once, the others the next time they use theirs.
+Returns the generation that carries the invalidation.
+*/
+unsigned long shootdown_TLB(unsigned long start, unsigned long pages)
+{
+    struct TLB *t = get_TLB();
+    invalidate_TLB_range(t, start, pages);
+
+    lock_mutex(&shootdown_lock);
+    unsigned long generation = tlb_generation;
+    struct shootdown *entry = &shootdown_log[generation % SHOOTDOWN_LOG_SIZE];
+    __atomic_store_n(&entry->start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->pages, pages, __ATOMIC_RELAXED);
+    __atomic_store_n(&tlb_generation, generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shootdown_lock);
+
+    // our own TLB is already clean
+    if (t->generation == generation)
+    {
+        t->generation = generation + 1;
+    }
+    return generation + 1;
+}
+
+/*
+Marks the calling thread as copying to or from frames it translated until
+end_access(). The mark goes up before the TLB is brought up to date, so an
+evictor either sees it or its shootdown is applied here first.
+*/
+static void begin_access(struct TLB *t)
+{
+    for (;;)
+    {
+        __atomic_store_n(&t->access_gen, t->generation + 1, __ATOMIC_SEQ_CST);
+        unsigned long generation = __atomic_load_n(&tlb_generation, __ATOMIC_SEQ_CST);
+        if (generation == t->generation)
+        {
+            return;
+        }
+        sync_TLB(t, generation);
+    }
+}
+
+static void end_access(struct TLB *t)
+{
+    __atomic_store_n(&t->access_gen, 0, __ATOMIC_RELEASE);
+}
+
+/*
+Waits until no other thread can still be copying through a translation
+that the shootdown to generation dropped: each is either outside
+begin_access() or inside one that started with the shootdown applied.
+Threads inside never wait for anything, so this ends.
+*/
+static void wait_for_accesses(unsigned long generation)
+{
+    struct TLB *self = get_TLB();
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    lock_mutex(&tlb_registry_lock);
+    for (struct TLB *t = all_tlbs; t != NULL; t = t->next)
+    {
+        unsigned long mark;
+        while (t != self && (mark = __atomic_load_n(&t->access_gen, __ATOMIC_ACQUIRE)) != 0 && mark - 1 < generation)
+        {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&tlb_registry_lock);
+}
+
+// Counter update visible to print_TLB_missrate() from other threads
+static void count_TLB(unsigned long *counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+/*
+Page directory and page table entries are read and written with atomic
+word accesses, so walks need no lock while other threads map pages.
+*/
+static pte_t load_entry(pde_t table, unsigned long index)
+{
+    return __atomic_load_n((pte_t *)&physical_memory[table + index * sizeof(pte_t)], __ATOMIC_ACQUIRE);
+}
+
+static void store_entry(pde_t table, unsigned long index, pte_t value)
+{
+    __atomic_store_n((pte_t *)&physical_memory[table + index * sizeof(pte_t)], value, __ATOMIC_RELEASE);
+}
+
+// Installs value only if the entry still holds expected
+static bool publish_entry(pde_t table, unsigned long index, pte_t expected, pte_t value)
+{
+    return __atomic_compare_exchange_n((pte_t *)&physical_memory[table + index * sizeof(pte_t)], &expected,
+                                       value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Index of vpn's entry in its table at level, 0 being the top directory
+static inline unsigned long level_index(unsigned long vpn, int level)
+{
+    unsigned long entries = level == 0 ? PAGE_DIRECTORY_SIZE : PAGE_TABLE_SIZE;
+    return (vpn >> ((PT_LEVELS - 1 - level) * PT_BITS)) & (entries - 1);
+}
+
+// Virtual pages covered by one entry of a table at level
+static inline unsigned long level_span(int level)
+{
+    return 1UL << ((PT_LEVELS - 1 - level) * PT_BITS);
+}
+
+// Takes a frame for a page table and sets every entry to -1
+static pde_t new_table()
+{
+    long page_idx = get_next_page(); // for the page table
+    if (page_idx < 0)
+    {
+        perror("Ran out of physical memory");
+        exit(1);
+    }
+    memset(&physical_memory[page_idx], -1, PGSIZE);
+    STAT_ADD(tables_allocated, 1);
+    return page_idx;
+}
+
+/*
+Returns the table that entry index of table points to, installing a fresh
+table filled with -1 there first when create is set and it is still empty.
+When two threads race to install one, the loser frees its frame and uses
+the winner's.
+*/
+static pde_t next_table(pde_t table, unsigned long index, bool create)
+{
+    pde_t next = load_entry(table, index);
+    if (next != (pde_t)-1 || !create)
+    {
+        return next;
+    }
+
+    // all the page values are -1 before any walk can see the table
+    long page_idx = new_table();
+    if (publish_entry(table, index, (pde_t)-1, page_idx))
+    {
+        return page_idx;
+    }
+    // another thread installed the table first
+    free_page(page_idx);
+    STAT_ADD(tables_freed, 1);
+    return load_entry(table, index);
+}
+
+/*
+Walks from pgdir down to the table at level PT_LEVELS - 2, the one whose
+entries point to page tables or map large pages, and returns it, or -1 if a
+table on the way is missing and create is not set. The steps are spelled
+out per level count so every walk is straight line code with constant
+shifts and masks.
+*/
+static pde_t walk_upper(pde_t pgdir, unsigned long vpn, bool create)
+{
+    pde_t table = pgdir;
+#if PT_LEVELS == 4
+    table = next_table(table, level_index(vpn, 0), create);
+    if (table == (pde_t)-1)
+    {
+        return table;
+    }
+    table = next_table(table, level_index(vpn, 1), create);
+#elif PT_LEVELS == 3
+    table = next_table(table, level_index(vpn, 0), create);
+#endif
+    return table;
+}
+
+/*
+Function responsible for allocating and setting your physical memory
+@Author - Advith
+*/
+void set_physical_mem()
+{
+    // TLBs are per thread and get created on first use
+
+    // Allocate physical memory using mmap or malloc; this is the total size of
+    // your memory you are simulating. Only address space is reserved here: the
+    // kernel backs each frame with zeroed memory the first time it is touched,
+    // and frames are initialized when they are handed out.
+    void *memory = mmap(NULL, MEMSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("Failed to allocate physical memory");
+        exit(1);
+    }
+    physical_memory = (char *)memory;
+
+    // HINT: Also calculate the number of physical and virtual pages and allocate
+    // virtual and physical bitmaps and initialize them
+    init_frame_bitmap(); // Mark all physical pages as unallocated
+
+    // per frame paging state, all clear: nothing is evictable yet
+    frame_owner = (unsigned long *)calloc(NUM_FRAMES, sizeof(unsigned long));
+    frame_space = (uint8_t *)calloc(NUM_FRAMES, sizeof(uint8_t));
+    frame_slot = (unsigned long *)calloc(NUM_FRAMES, sizeof(unsigned long));
+    frame_shares = (unsigned int *)calloc(NUM_FRAMES, sizeof(unsigned int));
+    frame_pins = (unsigned int *)calloc(NUM_FRAMES, sizeof(unsigned int));
+    frame_hash = (uint32_t *)calloc(NUM_FRAMES, sizeof(uint32_t));
+    frame_age = (uint8_t *)calloc(NUM_FRAMES, sizeof(uint8_t));
+    frame_queue = (uint8_t *)calloc(NUM_FRAMES, sizeof(uint8_t));
+    queue_prev = (unsigned int *)calloc(NUM_FRAMES, sizeof(unsigned int));
+    queue_next = (unsigned int *)calloc(NUM_FRAMES, sizeof(unsigned int));
+    if (frame_owner == NULL || frame_space == NULL || frame_slot == NULL || frame_shares == NULL ||
+        frame_pins == NULL || frame_hash == NULL || frame_age == NULL || frame_queue == NULL || queue_prev == NULL || queue_next == NULL)
+    {
+        perror("Failed to allocate frame tables");
+        exit(1);
+    }
+
+    // Mark all virtual pages as unallocated, nothing in the first page
+    insert_extent(&initial_space, 1, NUM_VIRTUAL_PAGES - 1);
+}
+
+/*
+Returns the entry one level above the page tables for vpn: the page table
+covering it, a large page, or -1. Page table addresses found by a full walk
+are kept in the thread's walk cache, so the next TLB miss in the same
+region goes straight to the page table. Entries are dropped by the same
+shootdowns as TLB entries, and all of them when the walk starts from
+another directory. A full walk counts in page_walks when miss is set, for
+a lookup the TLB missed rather than a retry or a write through a clean
+translation.
+*/
+static pde_t walk_table(struct TLB *t, pde_t pgdir, unsigned long vpn, bool miss)
+{
+    bool cached = __atomic_load_n(&walk_cache_enabled, __ATOMIC_RELAXED);
+    unsigned long region = vpn >> PT_BITS;
+    unsigned int slot = region & (WALK_CACHE_ENTRIES - 1);
+    if (cached && t->walk_root == pgdir && t->walk_tags[slot] == region)
+    {
+        return t->walk_tables[slot];
+    }
+
+    if (miss)
+    {
+        STAT_ADD(page_walks, 1);
+    }
+    pde_t upper = walk_upper(pgdir, vpn, false);
+    if (upper == (pde_t)-1)
+    {
+        return -1;
+    }
+    pde_t pg_tbl = load_entry(upper, level_index(vpn, PT_LEVELS - 2));
+    if (cached && pg_tbl != (pde_t)-1 && !(pg_tbl & PDE_LARGE))
+    {
+        if (t->walk_root != pgdir)
+        {
+            for (unsigned int i = 0; i < WALK_CACHE_ENTRIES; i++)
+            {
+                t->walk_tags[i] = TLB_INVALID;
+            }
+            t->walk_root = pgdir;
+        }
+        t->walk_tags[slot] = region;
+        t->walk_tables[slot] = pg_tbl;
+    }
+    return pg_tbl;
+}
+
+static pte_t lookup_TLB(struct TLB *t, uint64_t vpn, bool *dirty);
+static void trace_access(unsigned long vpn, bool write);
+static void record_malloc(void *va, unsigned long size);
+static void record_free(void *va);
+static void record_copy(int op, void *va, unsigned long len);
+static void record_resize(void *va, void *moved, unsigned long size);
+static void fill_TLB(struct TLB *t, uint64_t vpn, unsigned long frame);
+static bool fault_in(struct address_space *as, pde_t table, unsigned long index, unsigned long vpn, pte_t pte);
+static void record_access(struct address_space *as, unsigned long vpn, bool ahead);
+static void copy_shared(struct address_space *as, pde_t table, unsigned long index, unsigned long vpn, pte_t pte);
+static void copy_shared_large(struct address_space *as, unsigned long vpn);
+
+/*
+Translates va in the address space as through the calling thread's TLB t
+for a read, or a write when write is set. A miss walks the page table and
+marks the entry accessed, and dirty for a write, before caching it; so does
+the first write through a translation a read cached. A page that is swapped
+out, or on its way out or in, is faulted in and waited for when can_fault
+is set and gives PTE_FAULT otherwise; the wait counts as stall time, and
+the fault, like the first touch of a page read ahead, goes to the stream
+detector. A write to a page shared with another address space copies it
+first, under the same can_fault rule, and shared pages are only cached
+for reading. Returns -1 for an unmapped address.
+*/
+static pte_t translate_access(struct TLB *t, struct address_space *as, unsigned long va, bool write, bool can_fault)
+{
+    unsigned long vpn = va >> PGSHIFT;
+    unsigned long offset = va & (PGSIZE - 1);
+    if (__atomic_load_n(&trace_on, __ATOMIC_RELAXED))
+    {
+        trace_access(vpn, write);
+    }
+    tag_TLB(t, as); // flushing what another address space left
+
+    // check tlb cache for a translation
+    bool dirty;
+    pte_t page = lookup_TLB(t, vpn, &dirty);
+    if (page != (pte_t)-1)
+    {
+        count_TLB(&t->hits);
+        STAT_ADD(tlb_hits, 1);
+        if (!write || dirty)
+        {
+            return page + offset;
+        }
+    }
+    else
+    {
+        count_TLB(&t->misses);
+        STAT_ADD(tlb_misses, 1);
+    }
+
+    struct timespec stall_start;
+    bool stalled = false;          // the page had to come in first
+    bool miss = page == (pte_t)-1; // until the first walk
+    for (;;)
+    {
+        pde_t pg_tbl = walk_table(t, as->directory, vpn, miss);
+        miss = false;
+
+        // page directory has not been set yet
+        if (pg_tbl == -1)
+        {
+            // Accessing an invalid entry
+            return -1;
+        }
+
+        // the directory entry maps a large page itself
+        if (pg_tbl & PDE_LARGE)
+        {
+            pte_t large = pg_tbl & ~PDE_FLAGS;
+            if (!(pg_tbl & PDE_COW))
+            {
+                add_large_TLB(as, vpn / LARGE_PAGE_FRAMES, large);
+            }
+            else if (write)
+            {
+                if (!can_fault)
+                {
+                    return PTE_FAULT;
+                }
+                copy_shared_large(as, vpn);
+                continue;
+            }
+            return large + (va & (LARGE_PAGE_SIZE - 1));
+        }
+
+        unsigned long index = vpn & (PAGE_TABLE_SIZE - 1);
+        pte_t pte = load_entry(pg_tbl, index);
+
+        // page table has not been set yet
+        if (pte == -1)
+        {
+            // Accessing an invalid entry
+            return -1;
+        }
+        if (pte & (PTE_BUSY | PTE_SWAPPED))
+        {
+            if (!can_fault)
+            {
+                return PTE_FAULT;
+            }
+            if (!stalled)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &stall_start);
+                stalled = true;
+            }
+            if (pte & PTE_BUSY)
+            {
+                sched_yield();
+            }
+            else if (fault_in(as, pg_tbl, index, vpn, pte))
+            {
+                record_access(as, vpn, false);
+            }
+            continue;
+        }
+        if (stalled)
+        {
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            __atomic_fetch_add(&paging_stall_ns,
+                               (end.tv_sec - stall_start.tv_sec) * 1000000000UL + end.tv_nsec - stall_start.tv_nsec,
+                               __ATOMIC_RELAXED);
+            stalled = false;
+        }
+        if (write && (pte & PTE_COW))
+        {
+            if (!can_fault)
+            {
+                return PTE_FAULT;
+            }
+            copy_shared(as, pg_tbl, index, vpn, pte);
+            continue;
+        }
+
+        pte_t marked = (pte | PTE_ACCESSED | (write ? PTE_DIRTY : 0)) & ~PTE_AHEAD;
+        if (marked != pte && !publish_entry(pg_tbl, index, pte, marked))
+        {
+            continue; // an evictor or another thread changed it
+        }
+        if (pte & PTE_AHEAD)
+        {
+            record_access(as, vpn, true); // the stream caught up with what was read ahead
+        }
+        // add the translation to TLB
+        page = marked & ~PTE_FLAGS;
+        fill_TLB(t, vpn, page | ((marked & (PTE_DIRTY | PTE_COW)) == PTE_DIRTY ? TLB_DIRTY : 0));
+        return page + offset;
+    }
+}
+
+/*
+The function takes a virtual address and page directories starting address and
+performs translation to return the physical address. pgdir is the directory
+of the calling thread's address space or of another live one.
+@Author - Advith
+*/
+pte_t translate(pde_t pgdir, void *va)
+{
+    /* Part 1 HINT: Get the Page directory index (1st level) Then get the
+     * 2nd-level-page table index using the virtual address.  Using the page
+     * directory index and page table index get the physical address.
+     */
+    struct address_space *as = current_space();
+    for (int i = 0; i < MAX_SPACES && as->directory != pgdir; i++)
+    {
+        if (spaces[i] != NULL && spaces[i]->directory == pgdir)
+        {
+            as = spaces[i];
+        }
+    }
+    if (as->directory != pgdir)
+    {
+        return -1;
+    }
+    unsigned long timing = op_begin(VM_OP_TRANSLATE);
+    pte_t pa = translate_access(get_TLB(), as, (unsigned long)va, false, true);
+    op_end(VM_OP_TRANSLATE, timing);
+    return pa;
+}
+
+/*Function that gets the next available virtual address and takes the run
+of pages out of the free extents, with the first page a multiple of align
+(a power of two). Runs from a size class whose smallest member already fits
+are taken in O(1); only the class holding the request itself has to be
+searched for a long enough run. The search asks for enough slack to align
+any extent it finds, and the pages skipped in front stay free.
+@Author - Advith
+*/
+static unsigned long get_aligned_avail(struct address_space *as, unsigned long num_pages, unsigned long align)
+{
+    unsigned long pages = num_pages + align - 1;
+    int cls = extent_class(pages);
+
+    lock_mutex(&extent_lock);
+    int fit_cls = (pages & (pages - 1)) ? cls + 1 : cls;
+
+    struct extent *e = NULL;
+    uint64_t fitting = fit_cls < EXTENT_CLASSES ? as->extent_class_mask >> fit_cls : 0;
+    if (fitting != 0)
+    {
+        e = as->extent_classes[fit_cls + __builtin_ctzll(fitting)];
+    }
+    else
+    {
+        for (e = as->extent_classes[cls]; e != NULL && e->pages < pages; e = e->next)
+            ;
+    }
+    if (e == NULL)
+    {
+        perror("Ran out of memory");
+        exit(1);
+    }
+
+    unsigned long start = e->start;
+    unsigned long end = e->start + e->pages;
+    unsigned long aligned = (start + align - 1) & ~(align - 1);
+    remove_extent(as, e);
+    if (aligned > start)
+    {
+        insert_extent(as, start, aligned - start);
+    }
+    if (end > aligned + num_pages)
+    {
+        insert_extent(as, aligned + num_pages, end - aligned - num_pages);
+    }
+    pthread_mutex_unlock(&extent_lock);
+    return aligned;
+}
+
+// Gets num_pages free virtual pages of the calling thread's address space
+unsigned long get_next_avail(int num_pages)
+{
+    return get_aligned_avail(current_space(), num_pages, 1);
+}
+
+/*
+Returns count physically contiguous frames starting at pa to the bitmap.
+Their memory goes back to the kernel first, so it stops counting towards
+the resident set and reads as zero when the frames are handed out again.
+That has to happen before the frames are marked free, while no other
+thread can have been given them.
+*/
+static void release_frames(long pa, unsigned long count)
+{
+    if (madvise(&physical_memory[pa], count * PGSIZE, MADV_DONTNEED) != 0)
+    {
+        perror("Failed to release physical memory");
+        exit(1);
+    }
+    lock_mutex(&frame_lock);
+    for (unsigned long i = 0; i < count; i++)
+    {
+        mark_frame_free(pa / PGSIZE + i);
+    }
+    frames_in_use -= count;
+    pthread_mutex_unlock(&frame_lock);
+    STAT_ADD(frames_freed, count);
+}
+
+// Marks frame PIN_FREED if t_pin() holds it and tells whether it did
+static bool keep_pinned(unsigned long frame)
+{
+    unsigned int pins = __atomic_load_n(&frame_pins[frame], __ATOMIC_ACQUIRE);
+    while (pins != 0 && !__atomic_compare_exchange_n(&frame_pins[frame], &pins, pins | PIN_FREED, false,
+                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+    return pins != 0;
+}
+
+/*
+Gives back count frames from pa. Frames t_pin() still holds are skipped
+and left for the last t_unpin() to give back.
+*/
+static void free_frames(long pa, unsigned long count)
+{
+    unsigned long start = 0;
+    for (unsigned long i = 0; i <= count; i++)
+    {
+        if (i < count && !keep_pinned(pa / PGSIZE + i))
+        {
+            continue;
+        }
+        if (i > start)
+        {
+            release_frames(pa + start * PGSIZE, i - start);
+        }
+        start = i + 1;
+    }
+}
+
+static long evict_page(bool reuse);
+
+/*Function that gets the next available physical page, marks it used and
+returns its physical address. The search resumes where the previous one
+stopped so it does not rescan the full prefix. Once frame_limit frames are
+in use, or every frame is, a page is evicted and its frame taken over,
+cleared, which saves giving it back to the kernel and faulting it in
+again. Frames go back to get under a lowered limit only while there are
+enough evictable pages to get there. When nothing can be evicted, say while
+other threads are freeing theirs, the limit gives way and -1 comes back
+only once every frame is in use.
+@Author - Advith
+*/
+long get_next_page()
+{
+    bool over_limit = false;
+    for (;;)
+    {
+        long frame = -1;
+        bool shrink; // the limit was lowered below what is in use and evicting can get back under it
+        lock_mutex(&frame_lock);
+        if (frames_in_use < frame_limit || over_limit)
+        {
+            frame = find_free_frame(frame_cursor);
+            if (frame < 0)
+            {
+                frame = find_free_frame(0);
+            }
+        }
+        if (frame >= 0)
+        {
+            mark_frame_used(frame);
+            frame_cursor = (frame + 1) % NUM_FRAMES;
+            frames_in_use++;
+        }
+        shrink = frames_in_use > frame_limit &&
+                 frames_in_use - frame_limit <= __atomic_load_n(&evictable_frames, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&frame_lock);
+        if (frame >= 0)
+        {
+            STAT_ADD(frames_allocated, 1);
+            return frame * PGSIZE;
+        }
+        long pa = evict_page(!shrink);
+        if (pa >= 0 && !shrink)
+        {
+            memset(&physical_memory[pa], 0, PGSIZE);
+            return pa;
+        }
+        if (pa < 0)
+        {
+            if (over_limit)
+            {
+                return -1;
+            }
+            over_limit = true;
+        }
+    }
+}
+
+/*
+Takes a free frame under the frame limit for a page read ahead, or returns
+-1 when there is none. Reading ahead never evicts: a page it brought in
+early is not worth one still in use.
+*/
+static long get_free_page()
+{
+    lock_mutex(&frame_lock);
+    long frame = frames_in_use < frame_limit ? find_free_frame(frame_cursor) : -1;
+    if (frame < 0 && frames_in_use < frame_limit)
+    {
+        frame = find_free_frame(0);
+    }
+    if (frame >= 0)
+    {
+        mark_frame_used(frame);
+        frame_cursor = (frame + 1) % NUM_FRAMES;
+        frames_in_use++;
+    }
+    pthread_mutex_unlock(&frame_lock);
+    if (frame < 0)
+    {
+        return -1;
+    }
+    STAT_ADD(frames_allocated, 1);
+    return frame * PGSIZE;
+}
+
+/*
+Takes LARGE_PAGE_FRAMES free frames starting on a multiple of
+LARGE_PAGE_FRAMES and returns the physical address of the first, or -1 if
+no such run is free. Candidates are checked a bitmap word at a time,
+starting where the last search stopped.
+*/
+static long get_large_frames()
+{
+    unsigned long words = LARGE_PAGE_FRAMES / BITMAP_WORD_BITS;
+    unsigned long candidates = NUM_FRAMES / LARGE_PAGE_FRAMES;
+    long found = -1;
+
+    lock_mutex(&frame_lock);
+    if (frames_in_use + LARGE_PAGE_FRAMES > frame_limit)
+    {
+        candidates = 0; // large pages are never evicted, so they do not push others out
+    }
+    for (unsigned long n = 0; n < candidates && found < 0; n++)
+    {
+        unsigned long first = (large_cursor / LARGE_PAGE_FRAMES + n) % candidates * LARGE_PAGE_FRAMES;
+        const uint64_t *bits = &physical_bitmap[0][first / BITMAP_WORD_BITS];
+        unsigned long w = 0;
+        while (w < words && bits[w] == ~0ULL)
+        {
+            w++;
+        }
+        if (w == words)
+        {
+            found = first;
+        }
+    }
+    if (found >= 0)
+    {
+        for (unsigned long i = 0; i < LARGE_PAGE_FRAMES; i++)
+        {
+            mark_frame_used(found + i);
+        }
+        large_cursor = (found + LARGE_PAGE_FRAMES) % NUM_FRAMES;
+        frames_in_use += LARGE_PAGE_FRAMES;
+    }
+    pthread_mutex_unlock(&frame_lock);
+    if (found < 0)
+    {
+        return -1;
+    }
+    STAT_ADD(frames_allocated, LARGE_PAGE_FRAMES);
+    return found * PGSIZE;
+}
+
+/*
+Maps the LARGE_PAGE_FRAMES pages starting at vpn, which must be aligned,
+with a single large page in as. Returns false, mapping nothing, when no aligned
+run of frames is free or the directory entry already holds a page table
+left by earlier small pages; the caller then maps small pages instead.
+*/
+static bool map_large_page(struct address_space *as, unsigned long vpn)
+{
+    pde_t upper = walk_upper(as->directory, vpn, true);
+    unsigned long index = level_index(vpn, PT_LEVELS - 2);
+    if (load_entry(upper, index) != (pde_t)-1)
+    {
+        return false;
+    }
+    long pa = get_large_frames();
+    if (pa < 0)
+    {
+        return false;
+    }
+    if (!publish_entry(upper, index, (pde_t)-1, pa | PDE_LARGE))
+    {
+        free_frames(pa, LARGE_PAGE_FRAMES);
+        return false;
+    }
+    add_large_TLB(as, vpn / LARGE_PAGE_FRAMES, pa);
+    return true;
+}
+
+/*Function that returns a physical page handed out by get_next_page()
+@Author - Advith
+*/
+void free_page(long pa)
+{
+    free_frames(pa, 1);
+}
+
+/*
+The function takes a page directory address, virtual address, physical address
+as an argument, and sets a page table entry. This function will walk the page
+directory to see if there is an existing mapping for a virtual address. If the
+virtual address is not present, then a new entry will be added
+*/
+int page_map(pde_t pgdir, unsigned long va, pte_t pa)
+{
+    /*HINT: Similar to translate(), find the page directory (1st level)
+    and page table (2nd-level) indices. If no mapping exists, set the
+    virtual to physical mapping */
+
+    pte_t table_entry = va & (PAGE_TABLE_SIZE - 1); // table entry mem[d_entry + entry] + tbl_off
+
+    // missing tables on the way are created
+    pde_t upper = walk_upper(pgdir, va, true);
+    pde_t pg_tbl = next_table(upper, level_index(va, PT_LEVELS - 2), true);
+    store_entry(pg_tbl, table_entry, pa);
+
+    // after you add a new page table translation entry, also add a translation to the TLB by implementing add_TLB()
+    // (the calling thread's TLB only holds translations of its own address space)
+    if (pgdir == current_space()->directory)
+    {
+        add_TLB((void *)(va << PGSHIFT), (void *)(pa & ~PTE_FLAGS));
+    }
+    return 0;
+}
+
+// Unlinks a frame from the EVICT_2Q list it is on, if any
+static void queue_remove(unsigned int frame)
+{
+    int q = frame_queue[frame];
+    if (q == 0)
+    {
+        return;
+    }
+    unsigned int prev = queue_prev[frame];
+    unsigned int next = queue_next[frame];
+    if (prev == QUEUE_END)
+    {
+        queue_head[q] = next;
+    }
+    else
+    {
+        queue_next[prev] = next;
+    }
+    if (next == QUEUE_END)
+    {
+        queue_tail[q] = prev;
+    }
+    else
+    {
+        queue_prev[next] = prev;
+    }
+    queue_length[q]--;
+    frame_queue[frame] = 0;
+}
+
+// Moves a frame to the back of EVICT_2Q list q
+static void queue_append(unsigned int frame, int q)
+{
+    queue_remove(frame);
+    queue_prev[frame] = queue_tail[q];
+    queue_next[frame] = QUEUE_END;
+    if (queue_tail[q] == QUEUE_END)
+    {
+        queue_head[q] = frame;
+    }
+    else
+    {
+        queue_next[queue_tail[q]] = frame;
+    }
+    queue_tail[q] = frame;
+    queue_length[q]++;
+    frame_queue[frame] = q;
+}
+
+/*
+Makes the frame at pa, now mapping vpn in as, a candidate for eviction.
+EVICT_2Q starts it on probation unless it is a page that left probation
+unused and was asked for again.
+*/
+static void own_frame(long pa, struct address_space *as, unsigned long vpn, bool probation)
+{
+    unsigned long frame = pa / PGSIZE;
+    __atomic_store_n(&frame_age[frame], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame_space[frame], as->id, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame_owner[frame], vpn + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&evictable_frames, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&evict_policy, __ATOMIC_RELAXED) == EVICT_2Q)
+    {
+        lock_mutex(&evict_lock);
+        queue_append(frame, probation ? QUEUE_PROBATION : QUEUE_MAIN);
+        pthread_mutex_unlock(&evict_lock);
+    }
+}
+
+// Takes the frame at pa out of eviction; EVICT_2Q drops it from its list lazily
+static void disown_frame(long pa)
+{
+    unsigned long frame = pa / PGSIZE;
+    if (__atomic_load_n(&frame_owner[frame], __ATOMIC_RELAXED) != 0)
+    {
+        __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&evictable_frames, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+Hands out a swap slot, opening the swap file on first use. Without a path
+from set_paging_config() it is a temporary file unlinked right away.
+*/
+static unsigned long alloc_slot()
+{
+    lock_mutex(&swap_lock);
+    if (swap_fd < 0)
+    {
+        if (swap_file != NULL)
+        {
+            swap_fd = open(swap_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        }
+        else
+        {
+            char name[] = "/tmp/my_vm_swap.XXXXXX";
+            swap_fd = mkstemp(name);
+            if (swap_fd >= 0)
+            {
+                unlink(name);
+            }
+        }
+        if (swap_fd < 0)
+        {
+            perror("Failed to open swap file");
+            exit(1);
+        }
+    }
+    unsigned long slot = swap_free_count > 0 ? swap_free[--swap_free_count] : swap_next_slot++;
+    pthread_mutex_unlock(&swap_lock);
+    return slot;
+}
+
+// Puts a slot no page refers to any more back for reuse
+static void release_slot(unsigned long slot)
+{
+    lock_mutex(&swap_lock);
+    if (swap_free_count == swap_free_size)
+    {
+        swap_free_size = swap_free_size == 0 ? 1024 : swap_free_size * 2;
+        swap_free = (unsigned long *)realloc(swap_free, swap_free_size * sizeof(unsigned long));
+        if (swap_free == NULL)
+        {
+            perror("Failed to allocate swap slots");
+            exit(1);
+        }
+    }
+    swap_free[swap_free_count++] = slot;
+    pthread_mutex_unlock(&swap_lock);
+}
+
+// Write-back entry for slot, or a free entry when slot is 0; NULL if none
+static struct writeback *find_writeback(unsigned long slot)
+{
+    for (int i = 0; i < WRITEBACK_PAGES; i++)
+    {
+        if (writebacks[i].slot == slot)
+        {
+            return &writebacks[i];
+        }
+    }
+    return NULL;
+}
+
+static void free_writeback(struct writeback *w)
+{
+    w->slot = 0;
+    w->writing = false;
+    w->dropped = false;
+    writeback_used--;
+}
+
+/*
+Releases the swap slot of a page that is gone, cancelling its pending
+write. A slot being written right now is released by the write-back
+thread afterwards, so the write cannot land on a reused slot.
+*/
+static void free_slot(unsigned long slot)
+{
+    if (slot == 0)
+    {
+        return;
+    }
+    lock_mutex(&writeback_lock);
+    struct writeback *w = find_writeback(slot);
+    if (w != NULL && w->writing)
+    {
+        w->dropped = true;
+        pthread_mutex_unlock(&writeback_lock);
+        return;
+    }
+    if (w != NULL)
+    {
+        free_writeback(w);
+        writeback_queued--;
+        pthread_cond_broadcast(&writeback_done);
+    }
+    pthread_mutex_unlock(&writeback_lock);
+    release_slot(slot);
+}
+
+// Copies the frame at pa out to swap slot, or the slot into the frame
+static void swap_io(unsigned long slot, long pa, bool write)
+{
+    off_t offset = (off_t)(slot - 1) * PGSIZE;
+    ssize_t done = write ? pwrite(swap_fd, &physical_memory[pa], PGSIZE, offset)
+                         : pread(swap_fd, &physical_memory[pa], PGSIZE, offset);
+    if (done != PGSIZE)
+    {
+        perror(write ? "Failed to write swap" : "Failed to read swap");
+        exit(1);
+    }
+}
+
+static void start_io();
+
+/*
+Queues a copy of the dirty page at pa to be written to slot. A write still
+queued for the slot just gets the newer copy; one in flight, or a full
+queue, is waited for.
+*/
+static void queue_writeback(unsigned long slot, long pa)
+{
+    pthread_once(&io_once, start_io);
+    lock_mutex(&writeback_lock);
+    for (;;)
+    {
+        struct writeback *w = find_writeback(slot);
+        if (w != NULL && !w->writing)
+        {
+            memcpy(w->page, &physical_memory[pa], PGSIZE);
+            break;
+        }
+        if (w == NULL && (w = find_writeback(0)) != NULL)
+        {
+            memcpy(w->page, &physical_memory[pa], PGSIZE);
+            w->slot = slot;
+            writeback_used++;
+            writeback_queued++;
+            break;
+        }
+        writeback_full = true;
+        pthread_cond_signal(&writeback_wake);
+        pthread_cond_wait(&writeback_done, &writeback_lock);
+    }
+    if (writeback_queued >= WRITEBACK_BATCH)
+    {
+        pthread_cond_signal(&writeback_wake);
+    }
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+// Reads slot into the frame at pa, from its pending write if it has one
+static void read_slot(unsigned long slot, long pa)
+{
+    lock_mutex(&writeback_lock);
+    struct writeback *w = find_writeback(slot);
+    if (w != NULL)
+    {
+        memcpy(&physical_memory[pa], w->page, PGSIZE);
+    }
+    pthread_mutex_unlock(&writeback_lock);
+    if (w == NULL)
+    {
+        swap_io(slot, pa, false);
+    }
+}
+
+static int compare_writeback(const void *a, const void *b)
+{
+    unsigned long x = (*(struct writeback *const *)a)->slot;
+    unsigned long y = (*(struct writeback *const *)b)->slot;
+    return x < y ? -1 : x > y;
+}
+
+/*
+Write-back thread: waits for a batch of queued pages, or for the delay to
+pass, takes every queued page and writes them in slot order, runs of
+consecutive slots with a single pwritev(). The pages stay readable from
+their entries until they are on disk.
+*/
+static void *writeback_worker(void *arg)
+{
+    struct writeback *batch[WRITEBACK_PAGES];
+    struct iovec iov[WRITEBACK_PAGES];
+    (void)arg;
+
+    lock_mutex(&writeback_lock);
+    for (;;)
+    {
+        while (writeback_queued == 0)
+        {
+            pthread_cond_wait(&writeback_wake, &writeback_lock);
+        }
+        if (writeback_queued < WRITEBACK_BATCH && !writeback_full)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += WRITEBACK_DELAY_NS;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&writeback_wake, &writeback_lock, &until);
+        }
+        int count = 0;
+        for (int i = 0; i < WRITEBACK_PAGES; i++)
+        {
+            if (writebacks[i].slot != 0 && !writebacks[i].writing)
+            {
+                writebacks[i].writing = true;
+                batch[count++] = &writebacks[i];
+            }
+        }
+        writeback_queued = 0;
+        writeback_full = false;
+        pthread_mutex_unlock(&writeback_lock);
+
+        qsort(batch, count, sizeof(batch[0]), compare_writeback);
+        for (int i = 0; i < count;)
+        {
+            int run = 0;
+            do
+            {
+                iov[run].iov_base = batch[i + run]->page;
+                iov[run].iov_len = PGSIZE;
+                run++;
+            } while (i + run < count && batch[i + run]->slot == batch[i]->slot + run);
+            off_t offset = (off_t)(batch[i]->slot - 1) * PGSIZE;
+            if (pwritev(swap_fd, iov, run, offset) != (ssize_t)run * PGSIZE)
+            {
+                perror("Failed to write swap");
+                exit(1);
+            }
+            i += run;
+        }
+
+        lock_mutex(&writeback_lock);
+        for (int i = 0; i < count; i++)
+        {
+            if (batch[i]->dropped)
+            {
+                release_slot(batch[i]->slot);
+            }
+            free_writeback(batch[i]);
+        }
+        pthread_cond_broadcast(&writeback_done);
+    }
+    return NULL;
+}
+
+/*
+Finds the page table entry of the evictable page held by frame. Returns the
+entry, or -1 when the frame holds no such page, t_pin() holds it or the
+entry does not map it at the moment.
+*/
+static pte_t frame_entry(unsigned long frame, pde_t *table, unsigned long *index, unsigned long *vpn)
+{
+    unsigned long owner = __atomic_load_n(&frame_owner[frame], __ATOMIC_ACQUIRE);
+    if (owner == 0 || __atomic_load_n(&frame_pins[frame], __ATOMIC_RELAXED) != 0)
+    {
+        return -1;
+    }
+    *vpn = owner - 1;
+    pde_t upper = walk_upper(spaces[__atomic_load_n(&frame_space[frame], __ATOMIC_RELAXED)]->directory, *vpn, false);
+    pde_t pg_tbl = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, level_index(*vpn, PT_LEVELS - 2));
+    if (pg_tbl == (pde_t)-1 || (pg_tbl & PDE_LARGE))
+    {
+        return -1;
+    }
+    *table = pg_tbl;
+    *index = *vpn & (PAGE_TABLE_SIZE - 1);
+    pte_t pte = load_entry(pg_tbl, *index);
+    if (pte == (pte_t)-1 || (pte & (PTE_BUSY | PTE_SWAPPED)) || (pte & ~PTE_FLAGS) != frame * PGSIZE)
+    {
+        return -1;
+    }
+    return pte;
+}
+
+/*
+Clears the accessed bit of a resident entry and tells whether it was set.
+There is no shootdown: a page that stays in some TLB is marked again only
+after it misses there, which costs recency information but no correctness.
+*/
+static bool clear_accessed(pde_t table, unsigned long index)
+{
+    pte_t pte = load_entry(table, index);
+    while (pte != (pte_t)-1 && !(pte & (PTE_BUSY | PTE_SWAPPED)) && (pte & PTE_ACCESSED))
+    {
+        if (publish_entry(table, index, pte, pte & ~PTE_ACCESSED))
+        {
+            return true;
+        }
+        pte = load_entry(table, index);
+    }
+    return false;
+}
+
+// EVICT_CLOCK: the first page the hand finds unreferenced since its last pass
+static long clock_victim()
+{
+    for (unsigned long scanned = 0; scanned < 2 * NUM_FRAMES; scanned++)
+    {
+        unsigned long frame = evict_hand;
+        evict_hand = (evict_hand + 1) % NUM_FRAMES;
+        pde_t table;
+        unsigned long index, vpn;
+        if (frame_entry(frame, &table, &index, &vpn) != (pte_t)-1 && !clear_accessed(table, index))
+        {
+            return frame;
+        }
+    }
+    return -1;
+}
+
+/*
+EVICT_LRU_APPROX: ages the next AGING_BATCH pages, shifting each one's
+accessed bit into the top of its counter, and picks the oldest of them.
+*/
+static long lru_victim()
+{
+    long victim = -1;
+    uint8_t oldest = 0;
+    unsigned int aged = 0;
+    for (unsigned long scanned = 0; scanned < NUM_FRAMES && aged < AGING_BATCH; scanned++)
+    {
+        unsigned long frame = evict_hand;
+        evict_hand = (evict_hand + 1) % NUM_FRAMES;
+        pde_t table;
+        unsigned long index, vpn;
+        if (frame_entry(frame, &table, &index, &vpn) == (pte_t)-1)
+        {
+            continue;
+        }
+        uint8_t age = (__atomic_load_n(&frame_age[frame], __ATOMIC_RELAXED) >> 1) |
+                      (clear_accessed(table, index) ? 0x80 : 0);
+        __atomic_store_n(&frame_age[frame], age, __ATOMIC_RELAXED);
+        if (victim < 0 || age < oldest)
+        {
+            victim = frame;
+            oldest = age;
+        }
+        aged++;
+    }
+    return victim;
+}
+
+/*
+EVICT_2Q: new pages wait on a probation FIFO and leave it unused, tagged as
+ghosts, unless it is under its share; a ghost that comes back goes to the
+main queue, which gives its pages a second chance. Frames that no longer
+hold an evictable page are dropped from the lists here.
+*/
+static long twoq_victim(bool *ghost)
+{
+    for (unsigned long tries = 0; tries < 2 * NUM_FRAMES; tries++)
+    {
+        unsigned long probation = queue_length[QUEUE_PROBATION];
+        int q = probation > 0 && (probation * TWOQ_IN_SHARE > probation + queue_length[QUEUE_MAIN] ||
+                                  queue_length[QUEUE_MAIN] == 0)
+                    ? QUEUE_PROBATION
+                    : QUEUE_MAIN;
+        if (queue_length[q] == 0)
+        {
+            return -1;
+        }
+        unsigned int frame = queue_head[q];
+        pde_t table;
+        unsigned long index, vpn;
+        if (frame_entry(frame, &table, &index, &vpn) == (pte_t)-1)
+        {
+            // still owned means it is being faulted in or freed right now
+            if (__atomic_load_n(&frame_owner[frame], __ATOMIC_ACQUIRE) != 0)
+            {
+                queue_append(frame, q);
+            }
+            else
+            {
+                queue_remove(frame);
+            }
+            continue;
+        }
+        if (q == QUEUE_MAIN && clear_accessed(table, index))
+        {
+            queue_append(frame, QUEUE_MAIN);
+            continue;
+        }
+        queue_remove(frame);
+        *ghost = q == QUEUE_PROBATION;
+        return frame;
+    }
+    return -1;
+}
+
+/*
+Pushes one page out of memory and returns the physical address of its
+frame, which is freed unless reuse is set, in which case it stays in use
+for the caller; -1 if no page can be evicted. The victim's entry is held
+busy while every thread drops its translation and finishes copying through
+it; then a dirty page is queued for writing to its swap slot, while a clean
+one that still has a copy there, or was never written at all, is simply
+dropped.
+*/
+static long evict_page(bool reuse)
+{
+    if (__atomic_load_n(&evictable_frames, __ATOMIC_RELAXED) == 0)
+    {
+        return -1;
+    }
+    lock_mutex(&evict_lock);
+    for (;;)
+    {
+        bool ghost = false;
+        enum evict_policy policy = __atomic_load_n(&evict_policy, __ATOMIC_RELAXED);
+        long frame = policy == EVICT_2Q ? twoq_victim(&ghost) : policy == EVICT_LRU_APPROX ? lru_victim() : clock_victim();
+        if (frame < 0)
+        {
+            pthread_mutex_unlock(&evict_lock);
+            return -1;
+        }
+
+        pde_t table;
+        unsigned long index, vpn;
+        pte_t pte = frame_entry(frame, &table, &index, &vpn);
+        while (pte != (pte_t)-1 && !publish_entry(table, index, pte, pte | PTE_BUSY))
+        {
+            pte = frame_entry(frame, &table, &index, &vpn);
+        }
+        if (pte == (pte_t)-1)
+        {
+            continue; // freed meanwhile
+        }
+        if (__atomic_load_n(&frame_pins[frame], __ATOMIC_ACQUIRE) != 0)
+        {
+            store_entry(table, index, pte); // pinned before it was claimed
+            continue;
+        }
+        disown_frame(frame * PGSIZE);
+        wait_for_accesses(shootdown_TLB(vpn, 1));
+
+        // no thread can mark it any more
+        pte = load_entry(table, index);
+        unsigned long slot = frame_slot[frame];
+        bool dirty = pte & PTE_DIRTY;
+        if (dirty && slot == 0)
+        {
+            slot = alloc_slot();
+        }
+        frame_slot[frame] = 0;
+        __atomic_fetch_add(&paging_evictions, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&evict_lock);
+
+        // a full write-back queue only holds up this evictor and threads
+        // faulting on this page, whose entry stays busy until the store
+        if (dirty)
+        {
+            queue_writeback(slot, frame * PGSIZE);
+            __atomic_fetch_add(&paging_writebacks, 1, __ATOMIC_RELAXED);
+        }
+        store_entry(table, index, (slot << PGSHIFT) | PTE_SWAPPED | (ghost ? PTE_GHOST : 0));
+
+        if (!reuse)
+        {
+            free_frames(frame * PGSIZE, 1);
+        }
+        return frame * PGSIZE;
+    }
+}
+
+/*
+Makes a page read back into the frame at pa visible. The slot keeps its
+copy, so the page can be dropped again without writing it as long as it
+stays clean. A page read ahead is left unreferenced and marked PTE_AHEAD.
+*/
+static void install_page(struct swap_in *in, bool ahead)
+{
+    frame_slot[in->pa / PGSIZE] = in->pte >> PGSHIFT;
+    own_frame(in->pa, in->space, in->vpn, !(in->pte & PTE_GHOST));
+    store_entry(in->table, in->index, in->pa | (ahead ? PTE_AHEAD : PTE_ACCESSED));
+    __atomic_fetch_add(ahead ? &paging_prefetched : &paging_faults, 1, __ATOMIC_RELAXED);
+}
+
+// Takes a frame for a claimed page
+static void swap_in_frame(struct swap_in *in)
+{
+    in->pa = get_next_page();
+    if (in->pa < 0)
+    {
+        perror("Ran out of physical memory");
+        exit(1);
+    }
+}
+
+/*
+Brings the swapped out page vpn of as, whose entry held pte, back into a fresh
+frame, reading its slot unless it was never written. The entry stays busy
+meanwhile so no one else faults it in too. Returns false if someone else
+got to the entry first.
+*/
+static bool fault_in(struct address_space *as, pde_t table, unsigned long index, unsigned long vpn, pte_t pte)
+{
+    struct swap_in in = {as, table, index, vpn, pte, -1};
+    if (!publish_entry(table, index, pte, pte | PTE_BUSY))
+    {
+        return false;
+    }
+    swap_in_frame(&in);
+    if (pte >> PGSHIFT != 0)
+    {
+        read_slot(pte >> PGSHIFT, in.pa);
+    }
+    install_page(&in, false);
+    return true;
+}
+
+/*
+Adds an entry mapping the frame at pa, the first of frames frames, next to
+those already mapping it. The zero page is only counted.
+*/
+static void share_frame(long pa, unsigned long frames)
+{
+    if (pa == zero_page)
+    {
+        __atomic_fetch_add(&zero_mappings, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&frame_shares[pa / PGSIZE], 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&shared_frames, frames, __ATOMIC_RELAXED);
+}
+
+/*
+Drops one entry's hold on the shared frame at pa, the first of frames
+frames. Returns true when no other entry held it any more, in which case
+the caller was its last user. The zero page always has another.
+*/
+static bool unshare_frame(long pa, unsigned long frames)
+{
+    if (pa == zero_page)
+    {
+        __atomic_fetch_sub(&zero_mappings, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    unsigned int *shares = &frame_shares[pa / PGSIZE];
+    unsigned int n = __atomic_load_n(shares, __ATOMIC_ACQUIRE);
+    while (n > 0 && !__atomic_compare_exchange_n(shares, &n, n - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+    if (n > 0)
+    {
+        __atomic_fetch_sub(&shared_frames, frames, __ATOMIC_RELAXED);
+    }
+    return n == 0;
+}
+
+/*
+Gives vpn in as its own copy of the frame its entry pte shares with other
+entries, or just takes the frame over once they have all let go of it. A
+page still on the zero page gets a fresh frame, which reads as zero
+already. The entry stays busy meanwhile. The page is evictable again unless
+it is PTE_WIRED, and the last user of the old frame frees it after the
+threads still reading through it are done.
+*/
+static void copy_shared(struct address_space *as, pde_t table, unsigned long index, unsigned long vpn, pte_t pte)
+{
+    if (!publish_entry(table, index, pte, pte | PTE_BUSY))
+    {
+        return; // changed meanwhile, the caller looks again
+    }
+    long old = pte & ~PTE_FLAGS;
+    long pa = old;
+    bool last = old != zero_page && __atomic_load_n(&frame_shares[old / PGSIZE], __ATOMIC_ACQUIRE) == 0;
+    if (!last)
+    {
+        pa = get_next_page();
+        if (pa < 0)
+        {
+            perror("Ran out of physical memory");
+            exit(1);
+        }
+        if (old != zero_page)
+        {
+            memcpy(&physical_memory[pa], &physical_memory[old], PGSIZE);
+        }
+        last = unshare_frame(old, 1);
+    }
+    if (!(pte & PTE_WIRED))
+    {
+        own_frame(pa, as, vpn, true);
+    }
+    store_entry(table, index, pa | PTE_ACCESSED | PTE_DIRTY);
+    if (pa != old)
+    {
+        unsigned long generation = shootdown_TLB(vpn, 1);
+        if (last)
+        {
+            wait_for_accesses(generation);
+            free_frames(old, 1);
+        }
+    }
+}
+
+/*
+Gives the large page holding vpn in as its own copy of the frames it
+shares with other address spaces, or takes them over once the others have
+let go. The copy is a large page again when an aligned run of frames is
+free and a page table of evictable pages otherwise. Large entries have no
+busy bit, so this is serialized with t_clone() by space_lock.
+*/
+static void copy_shared_large(struct address_space *as, unsigned long vpn)
+{
+    unsigned long first = vpn & ~(unsigned long)(LARGE_PAGE_FRAMES - 1);
+    lock_mutex(&space_lock);
+    pde_t upper = walk_upper(as->directory, vpn, false);
+    unsigned long index = level_index(vpn, PT_LEVELS - 2);
+    pde_t entry = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, index);
+    if (entry == (pde_t)-1 || !(entry & PDE_COW))
+    {
+        pthread_mutex_unlock(&space_lock);
+        return; // freed or copied meanwhile
+    }
+    long old = entry & ~PDE_FLAGS;
+    if (__atomic_load_n(&frame_shares[old / PGSIZE], __ATOMIC_ACQUIRE) == 0)
+    {
+        store_entry(upper, index, old | PDE_LARGE);
+        pthread_mutex_unlock(&space_lock);
+        return;
+    }
+
+    long pa = get_large_frames();
+    if (pa >= 0)
+    {
+        memcpy(&physical_memory[pa], &physical_memory[old], LARGE_PAGE_SIZE);
+        store_entry(upper, index, pa | PDE_LARGE);
+    }
+    else
+    {
+        // evictors cannot reach these pages before the table is in place
+        pde_t pg_tbl = new_table();
+        for (unsigned long i = 0; i < LARGE_PAGE_FRAMES; i++)
+        {
+            long frame = get_next_page();
+            if (frame < 0)
+            {
+                perror("Ran out of physical memory");
+                exit(1);
+            }
+            memcpy(&physical_memory[frame], &physical_memory[old + i * PGSIZE], PGSIZE);
+            store_entry(pg_tbl, i, frame | PTE_ACCESSED | PTE_DIRTY);
+            own_frame(frame, as, first + i, true);
+        }
+        store_entry(upper, index, pg_tbl);
+    }
+    pthread_mutex_unlock(&space_lock);
+
+    unsigned long generation = shootdown_TLB(first, LARGE_PAGE_FRAMES);
+    if (unshare_frame(old, LARGE_PAGE_FRAMES))
+    {
+        wait_for_accesses(generation);
+        free_frames(old, LARGE_PAGE_FRAMES);
+    }
+}
+
+/*
+Clears the entry at index of the page table at table, waiting for an
+eviction or fault in progress on it to finish, and returns what it held.
+*/
+static pte_t clear_entry(pde_t table, unsigned long index)
+{
+    pte_t pte = load_entry(table, index);
+    while (pte != (pte_t)-1 && ((pte & PTE_BUSY) || !publish_entry(table, index, pte, (pte_t)-1)))
+    {
+        sched_yield();
+        pte = load_entry(table, index);
+    }
+    return pte;
+}
+
+/*
+Lets go of what a cleared entry held: its swap slot, or its frame unless
+another address space still shares it. Returns the physical address of
+the frame for the caller to free, or -1 if there is none.
+*/
+static long release_entry(pte_t pte)
+{
+    if (pte & PTE_SWAPPED)
+    {
+        free_slot(pte >> PGSHIFT);
+        return -1;
+    }
+    long pa = pte & ~PTE_FLAGS;
+    if ((pte & PTE_COW) && !unshare_frame(pa, 1))
+    {
+        return -1;
+    }
+    disown_frame(pa);
+    free_slot(frame_slot[pa / PGSIZE]);
+    frame_slot[pa / PGSIZE] = 0;
+    return pa;
+}
+
+/*
+Lets go of the frames of a large page unmapped from entry. Returns the
+physical address of the first one for the caller to free, or -1 while
+another address space still shares them.
+*/
+static long release_large(pde_t entry)
+{
+    if (!(entry & PDE_COW) || unshare_frame(entry & ~PDE_FLAGS, LARGE_PAGE_FRAMES))
+    {
+        return entry & ~PDE_FLAGS;
+    }
+    return -1;
+}
+
+/*
+Reads a batch of queued pages ahead: claims those still swapped out and
+not being brought in, gives each a free frame, and reads every run of
+consecutive slots with a single preadv(). Pages with a pending write are
+copied from it instead. Once no frame is free, the rest of the batch is
+dropped.
+*/
+static void prefetch_pages(const struct prefetch_request *requests, int count)
+{
+    struct swap_in batch[PREFETCH_BATCH];
+    struct iovec iov[PREFETCH_BATCH];
+    int claimed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct swap_in *in = &batch[claimed];
+        if (requests[i].space == NULL)
+        {
+            continue;
+        }
+        in->space = requests[i].space;
+        in->vpn = requests[i].vpn;
+        pde_t upper = walk_upper(in->space->directory, in->vpn, false);
+        in->table = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, level_index(in->vpn, PT_LEVELS - 2));
+        if (in->table == (pde_t)-1 || (in->table & PDE_LARGE))
+        {
+            continue;
+        }
+        in->index = in->vpn & (PAGE_TABLE_SIZE - 1);
+        in->pte = load_entry(in->table, in->index);
+        if (in->pte == (pte_t)-1 || !(in->pte & PTE_SWAPPED) || (in->pte & PTE_BUSY))
+        {
+            continue;
+        }
+        in->pa = get_free_page();
+        if (in->pa < 0)
+        {
+            break; // no free frames: the rest of the batch is left to fault in
+        }
+        if (publish_entry(in->table, in->index, in->pte, in->pte | PTE_BUSY))
+        {
+            claimed++;
+        }
+        else
+        {
+            free_page(in->pa);
+        }
+    }
+
+    // never written, or still waiting to be: nothing to read from the file
+    bool in_file[PREFETCH_BATCH];
+    lock_mutex(&writeback_lock);
+    for (int i = 0; i < claimed; i++)
+    {
+        unsigned long slot = batch[i].pte >> PGSHIFT;
+        struct writeback *w = slot == 0 ? NULL : find_writeback(slot);
+        if (w != NULL)
+        {
+            memcpy(&physical_memory[batch[i].pa], w->page, PGSIZE);
+        }
+        in_file[i] = slot != 0 && w == NULL;
+    }
+    pthread_mutex_unlock(&writeback_lock);
+
+    for (int i = 0; i < claimed;)
+    {
+        if (!in_file[i])
+        {
+            i++;
+            continue;
+        }
+        unsigned long first = batch[i].pte >> PGSHIFT;
+        int run = 0;
+        do
+        {
+            iov[run].iov_base = &physical_memory[batch[i + run].pa];
+            iov[run].iov_len = PGSIZE;
+            run++;
+        } while (i + run < claimed && in_file[i + run] && batch[i + run].pte >> PGSHIFT == first + run);
+        if (preadv(swap_fd, iov, run, (off_t)(first - 1) * PGSIZE) != (ssize_t)run * PGSIZE)
+        {
+            perror("Failed to read swap");
+            exit(1);
+        }
+        i += run;
+    }
+
+    for (int i = 0; i < claimed; i++)
+    {
+        install_page(&batch[i], true);
+    }
+}
+
+/*
+Prefetch thread: reads the queued pages in batches, in queue order. A batch
+is taken and read under prefetch_run_lock, so t_destroy() can wait for the
+one in progress after dropping the rest of its pages from the queue.
+*/
+static void *prefetch_worker(void *arg)
+{
+    struct prefetch_request requests[PREFETCH_BATCH];
+    (void)arg;
+    lock_mutex(&prefetch_lock);
+    for (;;)
+    {
+        while (prefetch_head == prefetch_tail)
+        {
+            pthread_cond_wait(&prefetch_wake, &prefetch_lock);
+        }
+        int count = 0;
+        while (count < PREFETCH_BATCH && prefetch_head != prefetch_tail)
+        {
+            requests[count++] = prefetch_queue[prefetch_head++ % PREFETCH_QUEUE];
+        }
+        lock_mutex(&prefetch_run_lock);
+        pthread_mutex_unlock(&prefetch_lock);
+        prefetch_pages(requests, count);
+        pthread_mutex_unlock(&prefetch_run_lock);
+        lock_mutex(&prefetch_lock);
+    }
+    return NULL;
+}
+
+// Starts the prefetch and write-back threads and sets up the write buffers
+static void start_io()
+{
+    char *pages = (char *)malloc((unsigned long)WRITEBACK_PAGES * PGSIZE);
+    if (pages == NULL)
+    {
+        perror("Failed to allocate write-back buffers");
+        exit(1);
+    }
+    for (int i = 0; i < WRITEBACK_PAGES; i++)
+    {
+        writebacks[i].page = &pages[(unsigned long)i * PGSIZE];
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, prefetch_worker, NULL) != 0 ||
+        pthread_create(&thread, NULL, writeback_worker, NULL) != 0)
+    {
+        perror("Failed to start I/O threads");
+        exit(1);
+    }
+}
+
+/*
+Tells the stream detector about a demand fault on vpn in as, or the first
+touch of a page read ahead when ahead is set. A fault one stride past the last
+touch of a stream, or a touch of a page read ahead for it, follows that
+stream and keeps PREFETCH_DEPTH strides of pages queued ahead of it. Otherwise a touch
+within PREFETCH_MAX_STRIDE pages of a stream seen once gives that stream
+its stride, and anything else starts a new stream in place of the least
+recently used.
+*/
+static void record_access(struct address_space *as, unsigned long vpn, bool ahead)
+{
+    if (!__atomic_load_n(&prefetch_enabled, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    pthread_once(&io_once, start_io);
+
+    lock_mutex(&prefetch_lock);
+    struct fault_stream *follows = NULL, *single = NULL, *oldest = &fault_streams[0];
+    for (int i = 0; i < PREFETCH_STREAMS; i++)
+    {
+        struct fault_stream *f = &fault_streams[i];
+        long distance = (long)vpn - (long)f->last;
+        if (f->stamp != 0 && f->space == as && f->stride != 0 && distance % f->stride == 0 &&
+            distance / f->stride >= 1 && distance / f->stride <= (ahead ? PREFETCH_DEPTH + 1 : 1))
+        {
+            follows = f;
+            break;
+        }
+        if (f->stamp != 0 && f->space == as && f->stride == 0 && distance != 0 &&
+            labs(distance) <= PREFETCH_MAX_STRIDE)
+        {
+            single = f;
+        }
+        if (f->stamp < oldest->stamp)
+        {
+            oldest = f;
+        }
+    }
+
+    struct fault_stream *f = follows != NULL ? follows : single != NULL ? single : oldest;
+    if (follows != NULL)
+    {
+        f->hits++;
+    }
+    else if (single != NULL)
+    {
+        f->stride = (long)vpn - (long)f->last;
+        f->next = vpn + f->stride;
+        f->hits = 0;
+    }
+    else
+    {
+        f->space = as;
+        f->stride = 0;
+        f->hits = 0;
+    }
+    f->last = vpn;
+    f->stamp = ++stream_clock;
+
+    // pages are only read ahead into free frames, so none are queued at the limit
+    if (f->hits > 0 && __atomic_load_n(&frames_in_use, __ATOMIC_RELAXED) < __atomic_load_n(&frame_limit, __ATOMIC_RELAXED))
+    {
+        if (((long)f->next - (long)f->last) / f->stride < 1)
+        {
+            f->next = f->last + f->stride;
+        }
+        while (((long)f->next - (long)f->last) / f->stride <= PREFETCH_DEPTH &&
+               prefetch_tail - prefetch_head < PREFETCH_QUEUE)
+        {
+            struct prefetch_request *r = &prefetch_queue[prefetch_tail++ % PREFETCH_QUEUE];
+            r->space = as;
+            r->vpn = f->next;
+            f->next += f->stride;
+        }
+        // a new stream is read at once, one being followed a batch at a time
+        if (f->hits == 1 || prefetch_tail - prefetch_head >= PREFETCH_BATCH)
+        {
+            pthread_cond_signal(&prefetch_wake);
+        }
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+static inline uint64_t rotl64(uint64_t x, int bits)
+{
+    return x << bits | x >> (64 - bits);
+}
+
+/*
+Hashes a page with the xxHash64 round over four interleaved lanes of
+words, then mixes the lanes down. Not cryptographic: matches are compared
+byte for byte before pages are merged. The scanner hashes pages that may
+be written meanwhile, so a hash is only ever a hint.
+*/
+static uint64_t page_hash(const char *page)
+{
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t lanes[4] = {prime1 + prime2, prime2, 0, -prime1};
+    const uint64_t *words = (const uint64_t *)page;
+    for (unsigned long i = 0; i < PGSIZE / sizeof(uint64_t); i += 4)
+    {
+        for (int l = 0; l < 4; l++)
+        {
+            lanes[l] = rotl64(lanes[l] + words[i + l] * prime2, 31) * prime1;
+        }
+    }
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    return h;
+}
+
+// Returns the page table holding vpn's entry in as, or -1 if it has none
+static pde_t page_table_of(struct address_space *as, unsigned long vpn)
+{
+    pde_t upper = walk_upper(as->directory, vpn, false);
+    pde_t table = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, level_index(vpn, PT_LEVELS - 2));
+    return table != (pde_t)-1 && (table & PDE_LARGE) ? (pde_t)-1 : table;
+}
+
+/*
+Whether the scanner may merge the page mapped by pte: one in memory, not
+the zero page already, and not written in place like slab pages and pinned
+pages are.
+*/
+static bool mergeable(pte_t pte)
+{
+    if (pte == (pte_t)-1 || (pte & (PTE_BUSY | PTE_SWAPPED | PTE_WIRED)))
+    {
+        return false;
+    }
+    long pa = pte & ~PTE_FLAGS;
+    return pa != zero_page && ((pte & PTE_COW) || (__atomic_load_n(&frame_owner[pa / PGSIZE], __ATOMIC_RELAXED) != 0 &&
+                                                   __atomic_load_n(&frame_pins[pa / PGSIZE], __ATOMIC_RELAXED) == 0));
+}
+
+/*
+Marks m's entry busy unless it changed or got pinned, taking a private
+page out of eviction.
+*/
+static bool claim_merge(struct merge_page *m)
+{
+    if (!publish_entry(m->table, m->index, m->pte, m->pte | PTE_BUSY))
+    {
+        return false;
+    }
+    if (!(m->pte & PTE_COW))
+    {
+        if (__atomic_load_n(&frame_pins[(m->pte & ~PTE_FLAGS) / PGSIZE], __ATOMIC_ACQUIRE) != 0)
+        {
+            store_entry(m->table, m->index, m->pte);
+            return false;
+        }
+        disown_frame(m->pte & ~PTE_FLAGS);
+    }
+    return true;
+}
+
+// Gives m's entry back as it was
+static void unclaim_merge(struct merge_page *m)
+{
+    if (!(m->pte & PTE_COW))
+    {
+        own_frame(m->pte & ~PTE_FLAGS, m->space, m->vpn, true);
+    }
+    store_entry(m->table, m->index, m->pte);
+}
+
+/*
+Maps p to the frame of e, or to the zero page when e is NULL, copy on
+write, if their contents are equal. Both entries are held busy, which pins
+their frames, and the threads that could still write through a writable
+translation of either are waited for before comparing. p's old frame is
+freed unless something else still maps it.
+*/
+static void merge_into(struct merge_page *e, struct merge_page *p)
+{
+    if (e != NULL && !claim_merge(e))
+    {
+        return;
+    }
+    if (!claim_merge(p))
+    {
+        if (e != NULL)
+        {
+            unclaim_merge(e);
+        }
+        return;
+    }
+    unsigned long generation = shootdown_TLB(p->vpn, 1);
+    if (e != NULL && !(e->pte & PTE_COW))
+    {
+        generation = shootdown_TLB(e->vpn, 1);
+    }
+    wait_for_accesses(generation);
+
+    long target = e != NULL ? (long)(e->pte & ~PTE_FLAGS) : zero_page;
+    long old = p->pte & ~PTE_FLAGS;
+    if (memcmp(&physical_memory[old], &physical_memory[target], PGSIZE) != 0)
+    {
+        if (e != NULL)
+        {
+            unclaim_merge(e);
+        }
+        unclaim_merge(p);
+        return;
+    }
+
+    if (e != NULL)
+    {
+        if (!(e->pte & PTE_COW))
+        {
+            free_slot(frame_slot[target / PGSIZE]); // the frame is never written to it now
+            frame_slot[target / PGSIZE] = 0;
+        }
+        store_entry(e->table, e->index, target | PTE_COW);
+    }
+    share_frame(target, 1);
+    store_entry(p->table, p->index, target | PTE_COW);
+    if (!(p->pte & PTE_COW) || unshare_frame(old, 1))
+    {
+        free_slot(frame_slot[old / PGSIZE]);
+        frame_slot[old / PGSIZE] = 0;
+        free_frames(old, 1);
+    }
+    __atomic_fetch_add(&merge_merged, 1, __ATOMIC_RELAXED);
+}
+
+/*
+Looks at the entry at index of table, mapping vpn in as. A page whose hash
+changed since the scanner last saw its frame is left alone for now. A
+stable one goes to the zero page if it reads as zero, or to the frame of
+the page with the same hash seen earlier in this pass, and is remembered
+for the pages after it otherwise.
+*/
+static void merge_page(struct address_space *as, pde_t table, unsigned long index, unsigned long vpn)
+{
+    struct merge_page p = {as, table, index, vpn, load_entry(table, index)};
+    if (!mergeable(p.pte))
+    {
+        return;
+    }
+    long pa = p.pte & ~PTE_FLAGS;
+    uint64_t hash = page_hash(&physical_memory[pa]);
+    __atomic_fetch_add(&merge_scanned, 1, __ATOMIC_RELAXED);
+    bool stable = frame_hash[pa / PGSIZE] == (uint32_t)hash || (p.pte & PTE_COW);
+    frame_hash[pa / PGSIZE] = (uint32_t)hash;
+    if (!stable)
+    {
+        return;
+    }
+    if (hash == zero_hash)
+    {
+        merge_into(NULL, &p);
+        return;
+    }
+
+    struct merge_candidate *c = NULL;
+    for (unsigned long i = 0; i < MERGE_PROBES; i++)
+    {
+        c = &merge_table[(hash + i) % MERGE_TABLE_SIZE];
+        if (c->space == NULL || c->hash == hash)
+        {
+            break;
+        }
+        c = NULL;
+    }
+    if (c == NULL)
+    {
+        return; // table full around this hash
+    }
+    struct merge_page e = {c->space, -1, c->vpn & (PAGE_TABLE_SIZE - 1), c->vpn, (pte_t)-1};
+    if (e.space != NULL)
+    {
+        e.table = page_table_of(e.space, e.vpn);
+        e.pte = e.table == (pde_t)-1 ? (pte_t)-1 : load_entry(e.table, e.index);
+    }
+    if (!mergeable(e.pte))
+    {
+        c->hash = hash; // gone or changed since, this page takes its place
+        c->space = as;
+        c->vpn = vpn;
+        return;
+    }
+    if ((long)(e.pte & ~PTE_FLAGS) != pa)
+    {
+        merge_into(&e, &p);
+    }
+}
+
+/*
+Scans the entries below table at level of as, covering the virtual pages
+from first on, from merge_vpn on while budget lasts. Returns true once it
+got past the last one.
+*/
+static bool merge_table_pages(struct address_space *as, pde_t table, int level, unsigned long first,
+                              unsigned long *budget)
+{
+    unsigned long entries = level == 0 ? PAGE_DIRECTORY_SIZE : PAGE_TABLE_SIZE;
+    unsigned long span = level_span(level);
+    for (unsigned long i = merge_vpn > first ? (merge_vpn - first) / span : 0; i < entries; i++)
+    {
+        unsigned long vpn = first + i * span;
+        if (*budget == 0)
+        {
+            return false;
+        }
+        if (level == PT_LEVELS - 1)
+        {
+            merge_page(as, table, i, vpn);
+            (*budget)--;
+        }
+        else
+        {
+            pde_t entry = load_entry(table, i);
+            if (entry != (pde_t)-1 && !(entry & PDE_LARGE) &&
+                !merge_table_pages(as, entry, level + 1, vpn, budget))
+            {
+                return false;
+            }
+        }
+        merge_vpn = vpn + span;
+    }
+    return true;
+}
+
+/*
+Moves the scanner to the start of the next space id, beginning a new pass
+with an empty table after the last. Runs under space_lock or merge_lock,
+so t_destroy() is not clearing the table meanwhile.
+*/
+static void next_merge_space()
+{
+    merge_vpn = 0;
+    if (++merge_space == MAX_SPACES)
+    {
+        merge_space = 0;
+        memset(merge_table, 0, sizeof(merge_table));
+    }
+}
+
+/*
+One round of the scanner: goes on through the space it was in, or the next
+live one, for up to budget page table entries.
+*/
+static void merge_round(unsigned long budget)
+{
+    lock_mutex(&space_lock);
+    while (spaces[merge_space] == NULL)
+    {
+        next_merge_space();
+    }
+    struct address_space *as = spaces[merge_space];
+    lock_mutex(&merge_lock);
+    pthread_mutex_unlock(&space_lock);
+
+    if (merge_table_pages(as, as->directory, 0, 0, &budget))
+    {
+        next_merge_space();
+    }
+    pthread_mutex_unlock(&merge_lock);
+}
+
+// Merge scanner: runs a round, then sleeps for the configured interval
+static void *merge_worker(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        lock_mutex(&merge_wake_lock);
+        while (merge_pages == 0)
+        {
+            pthread_cond_wait(&merge_wake, &merge_wake_lock);
+        }
+        unsigned long budget = merge_pages;
+        unsigned int interval_ms = merge_interval_ms;
+        pthread_mutex_unlock(&merge_wake_lock);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        merge_round(budget);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        __atomic_fetch_add(&merge_scan_ns,
+                           (unsigned long)((end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec),
+                           __ATOMIC_RELAXED);
+
+        struct timespec pause = {interval_ms / 1000, (long)(interval_ms % 1000) * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+/*
+Sets up physical memory and the page directory once, before the first
+allocation.
+*/
+static void init_vm()
+{
+    /*
+     * HINT: If the physical memory is not yet initialized, then allocate and initialize.
+     */
+    if (physical_memory == NULL)
+    {
+        set_physical_mem();
+    }
+
+    /*
+     * HINT: If the page directory is not initialized, then initialize the
+     * page directory.
+     */
+    for (int i = 0; i < SLAB_CLASSES; i++)
+    {
+        pthread_mutex_init(&slab_locks[i], NULL);
+    }
+    // the directory takes PD_FRAMES frames, which are contiguous because
+    // nothing else has been allocated yet
+    initial_space.directory = (pde_t)get_next_page();
+    for (unsigned long i = 1; i < PD_FRAMES; i++)
+    {
+        get_next_page();
+    }
+
+    // set all the directory values to -1
+    memset(&physical_memory[initial_space.directory], -1, PD_FRAMES * PGSIZE);
+    STAT_ADD(tables_allocated, PD_FRAMES);
+
+    zero_page = get_next_page();
+    zero_hash = page_hash(&physical_memory[zero_page]);
+}
+
+/*
+Maps pages virtual pages of as from vpn on, with large pages wherever a
+whole aligned one fits and they are enabled. Pages that may be swapped
+out, when evictable is set, read from the zero page until their first
+write gives them a frame; the others get a fresh physical page right away.
+*/
+static void map_pages(struct address_space *as, unsigned long vpn, unsigned long pages, bool evictable)
+{
+    bool large = __atomic_load_n(&large_pages_enabled, __ATOMIC_RELAXED) && pages >= LARGE_PAGE_FRAMES;
+    unsigned long zero_pages = 0;
+
+    for (unsigned long i = 0; i < pages; i++)
+    {
+        unsigned long curr_add = vpn + i; // next pages are just increments
+
+        if (large && i + LARGE_PAGE_FRAMES <= pages && curr_add % LARGE_PAGE_FRAMES == 0 &&
+            map_large_page(as, curr_add))
+        {
+            i += LARGE_PAGE_FRAMES - 1;
+            continue;
+        }
+        if (evictable)
+        {
+            page_map(as->directory, curr_add, zero_page | PTE_COW);
+            zero_pages++;
+            continue;
+        }
+
+        long val_idx = get_next_page();
+        if (val_idx < 0)
+        {
+            perror("Ran out of physical memory");
+            // TODO clean up allocated memory
+            exit(1);
+        }
+        page_map(as->directory, curr_add, val_idx);
+    }
+    __atomic_fetch_add(&zero_mappings, zero_pages, __ATOMIC_RELAXED);
+}
+
+/*
+Reserves num_pages contiguous virtual pages of as, aligned for large pages
+when they are enabled and the request holds one, and maps them with
+map_pages(). Returns the first virtual page number.
+*/
+static unsigned long alloc_pages(struct address_space *as, int pages_needed, bool evictable)
+{
+    /* Next, using get_next_avail(), check if there are free pages. If
+     * free pages are available, set the bitmaps and map a new page. Note, you will
+     * have to mark which physical pages are used.
+     */
+    bool large = __atomic_load_n(&large_pages_enabled, __ATOMIC_RELAXED) && pages_needed >= LARGE_PAGE_FRAMES;
+    unsigned long virtual_address = get_aligned_avail(as, pages_needed, large ? LARGE_PAGE_FRAMES : 1);
+    map_pages(as, virtual_address, pages_needed, evictable);
+    return virtual_address;
+}
+
+static int slab_class(unsigned int num_bytes)
+{
+    if (num_bytes <= SLAB_MIN_SIZE)
+    {
+        return 0;
+    }
+    return 32 - __builtin_clz(num_bytes - 1) - SLAB_MIN_SHIFT;
+}
+
+/*
+Returns the header of the slab page holding va in as. It is written in
+place, so a slab page shared with another address space is copied first.
+*/
+static struct slab_header *slab_header(struct address_space *as, unsigned long va)
+{
+    pte_t pa = translate_access(get_TLB(), as, va & ~(unsigned long)(PGSIZE - 1), true, true);
+    return (struct slab_header *)&physical_memory[pa + PGSIZE - sizeof(struct slab_header)];
+}
+
+// Returns the start of the slab page in physical memory
+static char *slab_page(struct slab_header *h)
+{
+    return (char *)h - (PGSIZE - sizeof(struct slab_header));
+}
+
+static bool slab_full(struct slab_header *h, unsigned int slot_size)
+{
+    return h->free_head == SLAB_NONE && h->bump + slot_size > PGSIZE - sizeof(struct slab_header);
+}
+
+static void slab_unlink(struct address_space *as, int cls, struct slab_header *h)
+{
+    if (h->prev != 0)
+    {
+        slab_header(as, h->prev)->next = h->next;
+    }
+    else
+    {
+        as->slab_partial[cls] = h->next;
+    }
+    if (h->next != 0)
+    {
+        slab_header(as, h->next)->prev = h->prev;
+    }
+}
+
+static void slab_push(struct address_space *as, int cls, unsigned long slab, struct slab_header *h)
+{
+    h->prev = 0;
+    h->next = as->slab_partial[cls];
+    if (h->next != 0)
+    {
+        slab_header(as, h->next)->prev = slab;
+    }
+    as->slab_partial[cls] = slab;
+}
+
+/*
+Hands out a slot of the given size class in as, starting a new slab page
+when no partial slab is left. Slabs leave the partial list once they fill
+up.
+*/
+static unsigned long slab_alloc(struct address_space *as, int cls)
+{
+    unsigned int slot_size = SLAB_MIN_SIZE << cls;
+    lock_mutex(&slab_locks[cls]);
+    unsigned long slab = as->slab_partial[cls];
+    struct slab_header *h;
+    if (slab == 0)
+    {
+        slab = alloc_pages(as, 1, false) << PGSHIFT; // slab headers are used in place
+        h = slab_header(as, slab);
+        h->free_head = SLAB_NONE;
+        h->bump = 0;
+        h->used = 0;
+        slab_push(as, cls, slab, h);
+    }
+    else
+    {
+        h = slab_header(as, slab);
+    }
+
+    unsigned int offset;
+    if (h->free_head != SLAB_NONE)
+    {
+        offset = h->free_head;
+        memcpy(&h->free_head, &slab_page(h)[offset], sizeof(unsigned int));
+    }
+    else
+    {
+        offset = h->bump;
+        h->bump += slot_size;
+    }
+    h->used++;
+    if (slab == as->slab_spare[cls])
+    {
+        as->slab_spare[cls] = 0;
+    }
+    if (slab_full(h, slot_size))
+    {
+        slab_unlink(as, cls, h);
+    }
+    pthread_mutex_unlock(&slab_locks[cls]);
+    return slab + offset;
+}
+
+/*
+Returns a slot to its slab in as. A slab that becomes empty is kept as the
+class's spare, reset so it is carved from the front again, unless there is
+one already: then it leaves the partial list and its address is returned
+for the caller to free the page. Returns 0 otherwise.
+*/
+static unsigned long slab_free(struct address_space *as, int cls, unsigned long va)
+{
+    unsigned int slot_size = SLAB_MIN_SIZE << cls;
+    unsigned long slab = va & ~(unsigned long)(PGSIZE - 1);
+    lock_mutex(&slab_locks[cls]);
+    struct slab_header *h = slab_header(as, slab);
+    unsigned int offset = va - slab;
+
+    if (slab_full(h, slot_size))
+    {
+        slab_push(as, cls, slab, h);
+    }
+    memcpy(&slab_page(h)[offset], &h->free_head, sizeof(unsigned int));
+    h->free_head = offset;
+    if (--h->used == 0)
+    {
+        if (as->slab_spare[cls] != 0)
+        {
+            slab_unlink(as, cls, h);
+            pthread_mutex_unlock(&slab_locks[cls]);
+            return slab;
+        }
+        h->free_head = SLAB_NONE;
+        h->bump = 0;
+        as->slab_spare[cls] = slab;
+    }
+    pthread_mutex_unlock(&slab_locks[cls]);
+    return 0;
+}
+
+/*
+Turns the page walk cache on or off, mostly to measure what it saves. Takes
+effect on the next TLB miss of every thread.
+*/
+void set_walk_cache(bool enabled)
+{
+    __atomic_store_n(&walk_cache_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+Turns the use of large pages by t_malloc() on or off for later requests.
+They are on by default; existing mappings are not changed.
+*/
+void set_large_pages(bool enabled)
+{
+    __atomic_store_n(&large_pages_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+Limits the frames in use to max_resident bytes, 0 lifting the limit, and
+selects the policy choosing which page goes to swap when one more frame is
+needed. Swap is written to swap_path, or to an unlinked temporary file when
+it is NULL or was never given. Page tables, slab pages and large pages stay
+resident but count towards the limit, and t_malloc() only uses large pages
+while they fit under it; the limit is exceeded only while nothing else can
+be evicted. A lower limit takes effect as pages are allocated or faulted
+in. The path can only change before anything has been written
+to swap. Returns 0 on success and -1 for a limit under MIN_RESIDENT_FRAMES
+pages or over physical memory, or a late path.
+*/
+int set_paging_config(unsigned long max_resident, enum evict_policy policy, const char *swap_path)
+{
+    pthread_once(&vm_once, init_vm);
+
+    unsigned long frames = max_resident == 0 ? NUM_FRAMES : max_resident / PGSIZE;
+    if (frames < MIN_RESIDENT_FRAMES || frames > NUM_FRAMES ||
+        (policy != EVICT_CLOCK && policy != EVICT_LRU_APPROX && policy != EVICT_2Q))
+    {
+        return -1;
+    }
+    if (swap_path != NULL)
+    {
+        lock_mutex(&swap_lock);
+        if (swap_next_slot > 1)
+        {
+            pthread_mutex_unlock(&swap_lock);
+            return -1;
+        }
+        char *path = strdup(swap_path);
+        if (path == NULL)
+        {
+            perror("Failed to allocate swap path");
+            exit(1);
+        }
+        if (swap_fd >= 0)
+        {
+            close(swap_fd);
+            swap_fd = -1;
+        }
+        free(swap_file);
+        swap_file = path;
+        pthread_mutex_unlock(&swap_lock);
+    }
+
+    lock_mutex(&evict_lock);
+    if (policy == EVICT_2Q && evict_policy != EVICT_2Q)
+    {
+        // resident pages start over on probation
+        for (unsigned long frame = 0; frame < NUM_FRAMES; frame++)
+        {
+            if (__atomic_load_n(&frame_owner[frame], __ATOMIC_ACQUIRE) != 0)
+            {
+                queue_append(frame, QUEUE_PROBATION);
+            }
+        }
+    }
+    __atomic_store_n(&evict_policy, policy, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&evict_lock);
+
+    lock_mutex(&frame_lock);
+    frame_limit = frames;
+    pthread_mutex_unlock(&frame_lock);
+    return 0;
+}
+
+/*
+Turns reading ahead of detected fault streams on or off; it is on by
+default. Pages are only read ahead into free frames, so at the resident
+limit streams fault in as they would without it. Pages already queued are
+still read.
+*/
+void set_prefetch(bool enabled)
+{
+    __atomic_store_n(&prefetch_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+// Fills in the demand paging counters since startup and the frames in use
+void get_paging_stats(struct paging_stats *stats)
+{
+    stats->faults = __atomic_load_n(&paging_faults, __ATOMIC_RELAXED);
+    stats->prefetched = __atomic_load_n(&paging_prefetched, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&paging_evictions, __ATOMIC_RELAXED);
+    stats->writebacks = __atomic_load_n(&paging_writebacks, __ATOMIC_RELAXED);
+    stats->stall_ns = __atomic_load_n(&paging_stall_ns, __ATOMIC_RELAXED);
+    lock_mutex(&frame_lock);
+    stats->resident = frames_in_use;
+    pthread_mutex_unlock(&frame_lock);
+}
+
+/*
+Fills in how fragmented free physical memory is: the free frames, the
+runs they form and the longest, and the free blocks a buddy allocator
+would keep, by order. A block of 2^order aligned frames counts at its
+order when it is not part of a free block of the next order; blocks of
+the last order all count. Looks at the whole bitmap under frame_lock.
+*/
+void get_frame_stats(struct frame_stats *stats)
+{
+    unsigned long aligned[VM_FRAME_ORDERS] = {0}; // free aligned blocks per order, inside larger ones too
+    unsigned long run = 0;
+    memset(stats, 0, sizeof(struct frame_stats));
+
+    lock_mutex(&frame_lock);
+    for (unsigned long w = 0; w < bitmap_words[0]; w++)
+    {
+        uint64_t bits = physical_bitmap[0][w];
+        stats->free_frames += __builtin_popcountll(bits);
+        for (int order = 0; order < VM_FRAME_ORDERS && (1UL << order) <= BITMAP_WORD_BITS; order++)
+        {
+            aligned[order] += __builtin_popcountll(free_block_starts(bits, 1UL << order));
+        }
+        for (int bit = 0; bit < BITMAP_WORD_BITS; bit++)
+        {
+            if (bits & (1ULL << bit))
+            {
+                stats->free_runs += run == 0;
+                run++;
+                stats->largest_free_run = run > stats->largest_free_run ? run : stats->largest_free_run;
+            }
+            else
+            {
+                run = 0;
+            }
+        }
+    }
+    for (int order = 0; order < VM_FRAME_ORDERS; order++)
+    {
+        unsigned long step = (1UL << order) / BITMAP_WORD_BITS; // whole words per block
+        for (unsigned long w = 0; step > 1 && w + step <= bitmap_words[0]; w += step)
+        {
+            unsigned long full = 0;
+            while (full < step && physical_bitmap[0][w + full] == ~0ULL)
+            {
+                full++;
+            }
+            aligned[order] += full == step;
+        }
+    }
+    pthread_mutex_unlock(&frame_lock);
+
+    for (int order = 0; order < VM_FRAME_ORDERS; order++)
+    {
+        stats->free_blocks[order] = aligned[order] - (order + 1 < VM_FRAME_ORDERS ? 2 * aligned[order + 1] : 0);
+    }
+}
+
+/*
+Has the merge scanner look at pages_per_round page table entries, then
+sleep for interval_ms, over and over; 0 pages stops it. It is off by
+default and its thread is started the first time it is turned on.
+*/
+void set_merge_config(unsigned int pages_per_round, unsigned int interval_ms)
+{
+    pthread_once(&vm_once, init_vm);
+    lock_mutex(&merge_wake_lock);
+    merge_pages = pages_per_round;
+    merge_interval_ms = interval_ms;
+    if (pages_per_round > 0 && !merge_started)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, merge_worker, NULL) != 0)
+        {
+            perror("Failed to start the merge scanner");
+            exit(1);
+        }
+        merge_started = true;
+    }
+    pthread_cond_signal(&merge_wake);
+    pthread_mutex_unlock(&merge_wake_lock);
+}
+
+// Fills in how many pages share frames right now and what the scanner did
+void get_merge_stats(struct merge_stats *stats)
+{
+    stats->zero_pages = __atomic_load_n(&zero_mappings, __ATOMIC_RELAXED);
+    stats->frames_saved = stats->zero_pages + __atomic_load_n(&shared_frames, __ATOMIC_RELAXED);
+    stats->merged = __atomic_load_n(&merge_merged, __ATOMIC_RELAXED);
+    stats->scanned = __atomic_load_n(&merge_scanned, __ATOMIC_RELAXED);
+    stats->scan_ns = __atomic_load_n(&merge_scan_ns, __ATOMIC_RELAXED);
+}
+
+/* Function responsible for allocating pages
+and used by the benchmark. Requests of up to SLAB_MAX_SIZE bytes share
+slab pages, larger ones get whole pages, in the calling thread's address
+space.
+@Author - Advith
+*/
+void *t_malloc(unsigned int num_bytes)
+{
+    pthread_once(&vm_once, init_vm);
+
+    unsigned long timing = op_begin(VM_OP_MALLOC);
+    struct address_space *as = current_space();
+    unsigned long virtual_address;
+    if (num_bytes <= SLAB_MAX_SIZE)
+    {
+        virtual_address = slab_alloc(as, slab_class(num_bytes));
+    }
+    else
+    {
+        int pages_needed = (num_bytes + PGSIZE - 1) / PGSIZE;
+        virtual_address = alloc_pages(as, pages_needed, true) << PGSHIFT;
+    }
+    op_end(VM_OP_MALLOC, timing);
+    if (__atomic_load_n(&record_on, __ATOMIC_RELAXED) && !record_nested)
+    {
+        record_malloc((void *)virtual_address, num_bytes);
+    }
+    return (void *)virtual_address;
+}
+
+// Copies len bytes between buf and physical memory at pa
+static void copy_run(unsigned long pa, char *buf, unsigned long len, bool to_memory)
+{
+    memcpy(to_memory ? &physical_memory[pa] : buf, to_memory ? buf : &physical_memory[pa], len);
+}
+
+/*
+Copies size bytes between buf and the virtual range starting at va in as,
+in the direction given by to_memory. Every page of the range is translated
+exactly once, and not at all if it is already in hints, a small direct
+mapped table of num_hints translations (a power of two) that also records
+the pages translated here; hints from before a shootdown are ignored.
+Pages whose frames follow each other in physical memory are merged into a
+single memcpy. The copying happens between begin_access() and
+end_access(), and a page that has to be faulted in is brought in outside
+of them. Returns 0, or -1 if part of the range is not mapped; the bytes
+before that page have been copied by then.
+*/
+static int copy_virtual(struct address_space *as, unsigned long va, char *buf, unsigned long size, bool to_memory,
+                        struct page_hint *hints, unsigned int num_hints)
+{
+    struct TLB *t = get_TLB();
+    unsigned long run_pa = 0;  // physical start of the pending contiguous run
+    unsigned long run_len = 0; // bytes in the pending run
+    int status = 0;
+
+    begin_access(t);
+    while (size > 0)
+    {
+        pte_t pa;
+        unsigned long vpn = va >> PGSHIFT;
+        struct page_hint *hint = &hints[vpn & (num_hints - 1)];
+        if (hint->valid && hint->vpn == vpn && hint->generation == t->generation)
+        {
+            pa = hint->pa + (va & (PGSIZE - 1));
+        }
+        else
+        {
+            while ((pa = translate_access(t, as, va, to_memory, false)) == PTE_FAULT)
+            {
+                // faulting may evict the pages of the pending run, so finish it first
+                if (run_len > 0)
+                {
+                    copy_run(run_pa, buf, run_len, to_memory);
+                    buf += run_len;
+                    run_len = 0;
+                }
+                end_access(t);
+                translate_access(t, as, va, to_memory, true);
+                begin_access(t);
+            }
+            if (pa == -1)
+            {
+                status = -1;
+                break;
+            }
+            hint->valid = true;
+            hint->vpn = vpn;
+            hint->pa = pa & ~(pte_t)(PGSIZE - 1);
+            hint->generation = t->generation;
+        }
+        unsigned long chunk = PGSIZE - (va & (PGSIZE - 1)); // bytes left on this page
+        if (chunk > size)
+        {
+            chunk = size;
+        }
+
+        if (run_len > 0 && pa == run_pa + run_len)
+        {
+            run_len += chunk;
+        }
+        else
+        {
+            if (run_len > 0)
+            {
+                copy_run(run_pa, buf, run_len, to_memory);
+                buf += run_len;
+            }
+            run_pa = pa;
+            run_len = chunk;
+        }
+        va += chunk;
+        size -= chunk;
+    }
+    if (run_len > 0)
+    {
+        copy_run(run_pa, buf, run_len, to_memory);
+    }
+    end_access(t);
+    return status;
+}
+
+/* The function copies data pointed by "val" to physical
+ * memory pages using virtual address (va)
+ * The function returns 0 if the put is successfull and -1 otherwise.
+ * @Author - Advith
+ */
+int put_value(void *va, void *val, int size)
+{
+    /* HINT: Using the virtual address and translate(), find the physical page. Copy
+     * the contents of "val" to a physical page. NOTE: The "size" value can be larger
+     * than one page. Therefore, you may have to find multiple pages using translate()
+     * function.
+     */
+
+    // Check if the virtual address is valid
+    if (va == NULL)
+    {
+        return -1; // Invalid virtual address
+    }
+
+    if (__atomic_load_n(&record_on, __ATOMIC_RELAXED) && !record_nested)
+    {
+        record_copy(RECORD_PUT, va, size);
+    }
+    unsigned long timing = op_begin(VM_OP_PUT);
+    struct page_hint last = {0};
+    if (copy_virtual(current_space(), (unsigned long)va, (char *)val, size, true, &last, 1) != 0)
+    {
+        perror("Invalid virtual address");
+        return -1;
+    }
+    op_end(VM_OP_PUT, timing);
+    return 0; // Successful data copy
+}
+
+/*Given a virtual address, this function copies the contents of the page to val
+@Author - Advith*/
+void get_value(void *va, void *val, int size)
+{
+    /* HINT: put the values pointed to by "va" inside the physical memory at given
+     * "val" address. Assume you can access "val" directly by derefencing them.
+     */
+
+    // Check if the virtual address is valid
+    if (__atomic_load_n(&record_on, __ATOMIC_RELAXED) && !record_nested)
+    {
+        record_copy(RECORD_GET, va, size);
+    }
+    unsigned long timing = op_begin(VM_OP_GET);
+    struct page_hint last = {0};
+    if (va == NULL || copy_virtual(current_space(), (unsigned long)va, (char *)val, size, false, &last, 1) != 0)
+    {
+        perror("Invalid virtual address");
+        exit(1);
+    }
+    op_end(VM_OP_GET, timing);
+}
+
+/*
+Runs a batch of copies in array order. The pages they touch are grouped by
+virtual page number in a table of BATCH_HINTS translations shared by the
+whole batch, so each distinct page is normally translated once however
+many descriptors land on it. Returns 0, or -1 if any descriptor touches
+unmapped memory; the others are still copied.
+*/
+static int copy_vector(const struct t_iovec *iov, int count, bool to_memory)
+{
+    int status = 0;
+    struct address_space *as = current_space();
+    struct page_hint hints[BATCH_HINTS];
+    memset(hints, 0, sizeof(hints));
+
+    for (int i = 0; i < count; i++)
+    {
+        if (iov[i].va == NULL ||
+            copy_virtual(as, (unsigned long)iov[i].va, (char *)iov[i].buf, iov[i].len, to_memory, hints,
+                         BATCH_HINTS) != 0)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/*
+Copies each descriptor's buffer into virtual memory at its va.
+Returns 0 if every copy succeeded and -1 otherwise.
+*/
+int t_writev(const struct t_iovec *iov, int count)
+{
+    return copy_vector(iov, count, true);
+}
+
+/*
+Copies virtual memory at each descriptor's va into its buffer.
+Returns 0 if every copy succeeded and -1 otherwise.
+*/
+int t_readv(const struct t_iovec *iov, int count)
+{
+    return copy_vector(iov, count, false);
+}
+
+/*
+Pins the page holding va in as and returns the physical address of va, or
+-1 when it is not mapped. The page is translated for a write first, which
+brings it in and gives it a frame of its own, then counted in frame_pins
+while its entry is held busy, so no eviction or merge is halfway through
+it. The entry is left dirty since the page may be written through a host
+pointer from now on. Large pages are never evicted or merged, and
+space_lock keeps t_clone() from sharing one meanwhile.
+*/
+static long pin_page(struct address_space *as, unsigned long va)
+{
+    unsigned long vpn = va >> PGSHIFT;
+    for (;;)
+    {
+        pte_t pa = translate_access(get_TLB(), as, va, true, true);
+        if (pa == (pte_t)-1)
+        {
+            return -1;
+        }
+        long frame = pa & ~(pte_t)(PGSIZE - 1);
+        unsigned long index = level_index(vpn, PT_LEVELS - 2);
+        pde_t upper = walk_upper(as->directory, vpn, false);
+        pde_t pg_tbl = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, index);
+        if (pg_tbl == (pde_t)-1)
+        {
+            continue; // freed meanwhile, the translation says so
+        }
+        if (pg_tbl & PDE_LARGE)
+        {
+            lock_mutex(&space_lock);
+            bool same = load_entry(upper, index) == pg_tbl && !(pg_tbl & PDE_COW) &&
+                        (long)(pg_tbl & ~PDE_FLAGS) + (long)(vpn % LARGE_PAGE_FRAMES) * PGSIZE == frame;
+            if (same)
+            {
+                __atomic_fetch_add(&frame_pins[frame / PGSIZE], 1, __ATOMIC_ACQ_REL);
+            }
+            pthread_mutex_unlock(&space_lock);
+            if (same)
+            {
+                return pa;
+            }
+            continue;
+        }
+        index = vpn & (PAGE_TABLE_SIZE - 1);
+        pte_t pte = load_entry(pg_tbl, index);
+        if (pte != (pte_t)-1 && !(pte & (PTE_BUSY | PTE_SWAPPED | PTE_COW)) && (long)(pte & ~PTE_FLAGS) == frame &&
+            publish_entry(pg_tbl, index, pte, pte | PTE_BUSY))
+        {
+            __atomic_fetch_add(&frame_pins[frame / PGSIZE], 1, __ATOMIC_ACQ_REL);
+            store_entry(pg_tbl, index, pte | PTE_ACCESSED | PTE_DIRTY);
+            return pa;
+        }
+    }
+}
+
+// Drops a pin on frame, giving it back if it was freed while pinned
+static void unpin_frame(unsigned long frame)
+{
+    if (__atomic_sub_fetch(&frame_pins[frame], 1, __ATOMIC_ACQ_REL) == PIN_FREED)
+    {
+        __atomic_store_n(&frame_pins[frame], 0, __ATOMIC_RELAXED);
+        release_frames(frame * PGSIZE, 1);
+    }
+}
+
+/*
+Pins the len bytes from va in the calling thread's address space and fills
+spans with host pointers to them: each span gets va, buf pointing at its
+bytes in physical memory, and len, pages whose frames follow each other
+sharing one span. Until t_unpin() the frames are not evicted, merged,
+shared copy on write or given back, even if the range is freed or moved,
+so loops can work on buf directly with no copies and no locking. No page
+takes more than one span, so len / PGSIZE + 2 of them always do. Returns
+the number of spans, or -1 with nothing pinned when part of the range is
+not mapped or max_spans is too few.
+*/
+int t_pin(void *va, size_t len, struct t_iovec *spans, int max_spans)
+{
+    struct address_space *as = current_space();
+    unsigned long addr = (unsigned long)va, end = addr + len;
+    int count = 0;
+    while (addr < end)
+    {
+        unsigned long chunk = PGSIZE - (addr & (PGSIZE - 1)); // bytes left on this page
+        if (chunk > end - addr)
+        {
+            chunk = end - addr;
+        }
+        long pa = va == NULL ? -1 : pin_page(as, addr);
+        struct t_iovec *last = count > 0 ? &spans[count - 1] : NULL;
+        if (pa >= 0 && last != NULL && &physical_memory[pa] == (char *)last->buf + last->len)
+        {
+            last->len += chunk;
+        }
+        else if (pa >= 0 && count < max_spans)
+        {
+            spans[count++] = (struct t_iovec){(void *)addr, &physical_memory[pa], chunk};
+        }
+        else
+        {
+            if (pa >= 0)
+            {
+                unpin_frame(pa / PGSIZE);
+            }
+            t_unpin(spans, count);
+            return -1;
+        }
+        addr += chunk;
+    }
+    return count;
+}
+
+/*
+Drops the pins of count spans t_pin() filled in. Frames of pages freed
+while they were pinned are given back with their last pin.
+*/
+void t_unpin(const struct t_iovec *spans, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        unsigned long offset = (char *)spans[i].buf - physical_memory;
+        for (unsigned long frame = offset / PGSIZE; frame <= (offset + spans[i].len - 1) / PGSIZE; frame++)
+        {
+            unpin_frame(frame);
+        }
+    }
+}
+
+/*
+Turns the large page holding vpn in as into a page table of evictable small
+pages over the same frames, so part of it can be freed. A large page shared
+with another address space gets its own copy first.
+*/
+static void split_large(struct address_space *as, unsigned long vpn)
+{
+    unsigned long first = vpn & ~(unsigned long)(LARGE_PAGE_FRAMES - 1);
+    unsigned long index = level_index(vpn, PT_LEVELS - 2);
+    pde_t upper, entry;
+    for (;;)
+    {
+        lock_mutex(&space_lock);
+        upper = walk_upper(as->directory, vpn, false);
+        entry = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, index);
+        if (entry == (pde_t)-1 || !(entry & PDE_LARGE))
+        {
+            pthread_mutex_unlock(&space_lock);
+            return;
+        }
+        if (!(entry & PDE_COW))
+        {
+            break;
+        }
+        pthread_mutex_unlock(&space_lock);
+        copy_shared_large(as, vpn);
+    }
+
+    // evictors cannot reach these pages before the table is in place
+    long pa = entry & ~PDE_FLAGS;
+    pde_t pg_tbl = new_table();
+    for (unsigned long i = 0; i < LARGE_PAGE_FRAMES; i++)
+    {
+        store_entry(pg_tbl, i, (pa + i * PGSIZE) | PTE_ACCESSED | PTE_DIRTY);
+        own_frame(pa + i * PGSIZE, as, first + i, true);
+    }
+    store_entry(upper, index, pg_tbl);
+    pthread_mutex_unlock(&space_lock);
+    shootdown_TLB(first, LARGE_PAGE_FRAMES);
+}
+
+static void free_tables(pde_t table, int level);
+
+// Runs of frames t_free() gives back once no TLB can reach them
+struct free_list
+{
+    struct free_run *runs;
+    unsigned long count, size;
+    struct free_run inline_runs[FREE_RUNS];
+};
+
+// Adds frames at pa, joining the last run when they follow it
+static void add_free_run(struct free_list *list, long pa, unsigned long frames, int level)
+{
+    struct free_run *last = list->count > 0 ? &list->runs[list->count - 1] : NULL;
+    if (frames > 0 && last != NULL && last->frames > 0 && pa == last->pa + (long)(last->frames * PGSIZE))
+    {
+        last->frames += frames;
+        return;
+    }
+    if (list->count == list->size)
+    {
+        struct free_run *runs = (struct free_run *)malloc(2 * list->size * sizeof(struct free_run));
+        if (runs == NULL)
+        {
+            perror("Failed to allocate free runs");
+            exit(1);
+        }
+        memcpy(runs, list->runs, list->count * sizeof(struct free_run));
+        if (list->runs != list->inline_runs)
+        {
+            free(list->runs);
+        }
+        list->runs = runs;
+        list->size *= 2;
+    }
+    list->runs[list->count++] = (struct free_run){pa, frames, level};
+}
+
+/*
+Unlinks from as the page tables whose whole range lies in the free extent
+gap and that cover some of the pages from first to end, just freed, and
+adds them to list. Higher tables go first, taking the tables below them
+along. The caller holds extent_lock, so nothing can be mapped there.
+*/
+static void unlink_tables(struct address_space *as, struct extent *gap, unsigned long first, unsigned long end,
+                          struct free_list *list)
+{
+    for (int level = 1; level < PT_LEVELS; level++)
+    {
+        unsigned long span = level_span(level - 1);
+        unsigned long vpn = first & ~(span - 1);
+        if (vpn < gap->start)
+        {
+            vpn += span;
+        }
+        for (; vpn < end && vpn + span <= gap->start + gap->pages; vpn += span)
+        {
+            pde_t parent = as->directory;
+            for (int l = 0; l < level - 1 && parent != (pde_t)-1; l++)
+            {
+                parent = load_entry(parent, level_index(vpn, l));
+            }
+            if (parent == (pde_t)-1)
+            {
+                continue;
+            }
+            pde_t table = load_entry(parent, level_index(vpn, level - 1));
+            if (table == (pde_t)-1 || (table & PDE_LARGE))
+            {
+                continue;
+            }
+            store_entry(parent, level_index(vpn, level - 1), (pde_t)-1);
+            add_free_run(list, table, 0, level);
+        }
+    }
+}
+
+/* Responsible for releasing one or more memory pages using virtual address (va)
+in the calling thread's address space. Frames shared with other address
+spaces stay with them; the last one to let go frees them.
+@Author - Advith
+*/
+void t_free(void *va, int size)
+{
+    /* Part 1: Free the page table entries starting from this virtual address
+     * (va). Also mark the pages free in the bitmap. Perform free only if the
+     * memory from "va" to va+size is valid.
+     *
+     * Part 2: Also, remove the translation from the TLB
+     */
+    unsigned long curr_add = (unsigned long)va;
+    struct address_space *as = current_space();
+    if (__atomic_load_n(&record_on, __ATOMIC_RELAXED) && !record_nested)
+    {
+        record_free(va);
+    }
+    unsigned long timing = op_begin(VM_OP_FREE);
+
+    if (size <= SLAB_MAX_SIZE)
+    {
+        // an emptied slab page goes back like any other page
+        curr_add = slab_free(as, slab_class(size), curr_add);
+        if (curr_add == 0)
+        {
+            op_end(VM_OP_FREE, timing);
+            return;
+        }
+        size = PGSIZE;
+    }
+
+    unsigned long first_page = curr_add >> PGSHIFT;
+    int pages = (size + PGSIZE - 1) / PGSIZE; // same rounding as t_malloc
+    unsigned long end = first_page + pages;
+
+    // large pages the range only partly covers keep the rest mapped
+    if (first_page % LARGE_PAGE_FRAMES != 0)
+    {
+        split_large(as, first_page);
+    }
+    if (end % LARGE_PAGE_FRAMES != 0)
+    {
+        split_large(as, end - 1);
+    }
+
+    // Every entry is cleared in one pass, and the frames are kept in
+    // physically contiguous runs, one madvise each
+    struct free_list list;
+    list.runs = list.inline_runs;
+    list.count = 0;
+    list.size = FREE_RUNS;
+    pde_t upper = (pde_t)-1;
+    pde_t pg_tbl = (pde_t)-1;
+    for (int i = 0; i < pages; i++)
+    {
+        unsigned long vpn = first_page + i;
+
+        // the walk only changes where the range of a new page table starts
+        if (i == 0 || vpn % PAGE_TABLE_SIZE == 0)
+        {
+            upper = walk_upper(as->directory, vpn, false);
+            pg_tbl = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, level_index(vpn, PT_LEVELS - 2));
+        }
+        if (pg_tbl == (pde_t)-1)
+        {
+            continue;
+        }
+        if (pg_tbl & PDE_LARGE)
+        {
+            store_entry(upper, level_index(vpn, PT_LEVELS - 2), (pde_t)-1);
+            long pa = release_large(pg_tbl);
+            if (pa >= 0)
+            {
+                add_free_run(&list, pa, LARGE_PAGE_FRAMES, 0);
+            }
+            i += LARGE_PAGE_FRAMES - 1;
+            continue;
+        }
+        pte_t pte = clear_entry(pg_tbl, vpn & (PAGE_TABLE_SIZE - 1));
+        long pa = pte == (pte_t)-1 ? -1 : release_entry(pte);
+        if (pa >= 0)
+        {
+            add_free_run(&list, pa, 1, 0);
+        }
+    }
+
+    // one shootdown for the range, and the frames stay out of the
+    // allocator until no thread can still be copying through them
+    wait_for_accesses(shootdown_TLB(first_page, pages));
+
+    lock_mutex(&extent_lock);
+    struct extent *gap = release_extent(as, first_page, pages);
+    unsigned long data_runs = list.count;
+    unlink_tables(as, gap, first_page, end, &list);
+    pthread_mutex_unlock(&extent_lock);
+
+    if (list.count > data_runs)
+    {
+        // an evictor, the prefetch thread, the merge scanner or t_clone()
+        // may still be walking through a table unlinked above
+        lock_mutex(&evict_lock);
+        pthread_mutex_unlock(&evict_lock);
+        lock_mutex(&prefetch_run_lock);
+        pthread_mutex_unlock(&prefetch_run_lock);
+        lock_mutex(&merge_lock);
+        pthread_mutex_unlock(&merge_lock);
+        lock_mutex(&space_lock);
+        pthread_mutex_unlock(&space_lock);
+    }
+    for (unsigned long i = 0; i < list.count; i++)
+    {
+        struct free_run *run = &list.runs[i];
+        if (run->frames > 0)
+        {
+            free_frames(run->pa, run->frames);
+            continue;
+        }
+        if (run->level < PT_LEVELS - 1)
+        {
+            free_tables(run->pa, run->level);
+        }
+        free_page(run->pa);
+        STAT_ADD(tables_freed, 1);
+    }
+    if (list.runs != list.inline_runs)
+    {
+        free(list.runs);
+    }
+    op_end(VM_OP_FREE, timing);
+}
+
+/*
+Moves the mappings of pages virtual pages of as from from to to, a free
+range with nothing mapped, leaving every frame, swap slot and share where
+it is. Small entries move one at a time, each cleared once no eviction or
+fault is halfway through it, and evictable frames follow them in
+frame_owner. A large page moves as a single directory entry when its
+offset within a large page is kept and the slot is empty, and becomes
+small pages in the page table left there otherwise. space_lock keeps
+t_clone() and the copying of shared large pages out meanwhile.
+*/
+static void move_pages(struct address_space *as, unsigned long from, unsigned long to, unsigned long pages)
+{
+    pde_t upper = (pde_t)-1, pg_tbl = (pde_t)-1, dest_tbl = (pde_t)-1;
+    lock_mutex(&space_lock);
+    for (unsigned long i = 0; i < pages; i++)
+    {
+        unsigned long vpn = from + i;
+        unsigned long target = to + i;
+
+        // the walks only change where the range of a new page table starts
+        if (i == 0 || vpn % PAGE_TABLE_SIZE == 0)
+        {
+            upper = walk_upper(as->directory, vpn, false);
+            pg_tbl = upper == (pde_t)-1 ? (pde_t)-1 : load_entry(upper, level_index(vpn, PT_LEVELS - 2));
+        }
+        if (pg_tbl == (pde_t)-1)
+        {
+            continue;
+        }
+        if (pg_tbl & PDE_LARGE)
+        {
+            pde_t dest_upper = walk_upper(as->directory, target, true);
+            pde_t dest = next_table(dest_upper, level_index(target, PT_LEVELS - 2), false);
+            bool whole = dest == (pde_t)-1 && target % LARGE_PAGE_FRAMES == 0;
+            if (!whole && (pg_tbl & PDE_COW))
+            {
+                // small entries cannot share a large page's frames
+                pthread_mutex_unlock(&space_lock);
+                copy_shared_large(as, vpn);
+                lock_mutex(&space_lock);
+                upper = walk_upper(as->directory, vpn, false);
+                pg_tbl = load_entry(upper, level_index(vpn, PT_LEVELS - 2));
+                i--;
+                continue;
+            }
+            if (whole)
+            {
+                store_entry(dest_upper, level_index(target, PT_LEVELS - 2), pg_tbl);
+            }
+            else
+            {
+                long pa = pg_tbl & ~PDE_FLAGS;
+                for (unsigned long j = 0; j < LARGE_PAGE_FRAMES; j++)
+                {
+                    page_map(as->directory, target + j, (pa + j * PGSIZE) | PTE_ACCESSED | PTE_DIRTY);
+                    own_frame(pa + j * PGSIZE, as, target + j, true);
+                }
+            }
+            store_entry(upper, level_index(vpn, PT_LEVELS - 2), (pde_t)-1);
+            i += LARGE_PAGE_FRAMES - 1;
+            continue;
+        }
+
+        pte_t pte = clear_entry(pg_tbl, vpn & (PAGE_TABLE_SIZE - 1));
+        if (pte == (pte_t)-1)
+        {
+            continue;
+        }
+        if (dest_tbl == (pde_t)-1 || target % PAGE_TABLE_SIZE == 0)
+        {
+            pde_t dest_upper = walk_upper(as->directory, target, true);
+            dest_tbl = next_table(dest_upper, level_index(target, PT_LEVELS - 2), true);
+        }
+        store_entry(dest_tbl, target & (PAGE_TABLE_SIZE - 1), pte);
+        unsigned long frame = (pte & ~PTE_FLAGS) / PGSIZE;
+        if (!(pte & (PTE_SWAPPED | PTE_COW)) && __atomic_load_n(&frame_owner[frame], __ATOMIC_RELAXED) != 0)
+        {
+            __atomic_store_n(&frame_owner[frame], target + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&space_lock);
+}
+
+static void *resize_allocation(void *va, unsigned int old_size, unsigned int new_size);
+
+/*
+Resizes the allocation of old_size bytes at va, as made by t_malloc(), to
+new_size bytes and returns where it is now, keeping the first bytes up to
+the smaller size. A NULL va allocates and a new_size of 0 frees. Whole page
+allocations shrink in place and grow in place when the free virtual pages
+right after them suffice. Otherwise the page mappings move to a new range
+and the frames stay put, so nothing is copied; only allocations moving to
+or from slab slots are copied. New pages read as zero.
+*/
+void *t_realloc(void *va, unsigned int old_size, unsigned int new_size)
+{
+    bool nested = record_nested;
+    record_nested = true;
+    void *moved = resize_allocation(va, old_size, new_size);
+    record_nested = nested;
+    if (__atomic_load_n(&record_on, __ATOMIC_RELAXED) && !nested)
+    {
+        record_resize(va, moved, new_size);
+    }
+    return moved;
+}
+
+// Does the work of t_realloc(), whose own calls are not recorded
+static void *resize_allocation(void *va, unsigned int old_size, unsigned int new_size)
+{
+    if (va == NULL)
+    {
+        return t_malloc(new_size);
+    }
+    if (new_size == 0)
+    {
+        t_free(va, old_size);
+        return NULL;
+    }
+
+    struct address_space *as = current_space();
+    if (old_size <= SLAB_MAX_SIZE || new_size <= SLAB_MAX_SIZE)
+    {
+        if (old_size <= SLAB_MAX_SIZE && new_size <= SLAB_MAX_SIZE && slab_class(old_size) == slab_class(new_size))
+        {
+            return va;
+        }
+        char buf[SLAB_MAX_SIZE];
+        unsigned int keep = old_size < new_size ? old_size : new_size;
+        void *moved = t_malloc(new_size);
+        get_value(va, buf, keep);
+        put_value(moved, buf, keep);
+        t_free(va, old_size);
+        return moved;
+    }
+
+    unsigned long first_page = (unsigned long)va >> PGSHIFT;
+    unsigned long old_pages = (old_size + PGSIZE - 1) / PGSIZE; // same rounding as t_malloc
+    unsigned long new_pages = (new_size + PGSIZE - 1) / PGSIZE;
+    if (new_pages <= old_pages)
+    {
+        if (new_pages < old_pages)
+        {
+            unsigned long end = first_page + new_pages;
+            if (end % LARGE_PAGE_FRAMES != 0)
+            {
+                split_large(as, end);
+            }
+            t_free((void *)(end << PGSHIFT), (old_pages - new_pages) * PGSIZE);
+        }
+        return va;
+    }
+
+    unsigned long extra = new_pages - old_pages;
+    lock_mutex(&extent_lock);
+    struct extent *after = extent_starting_at(as, first_page + old_pages);
+    bool in_place = after != NULL && after->pages >= extra;
+    if (in_place)
+    {
+        unsigned long rest = after->pages - extra;
+        remove_extent(as, after);
+        if (rest > 0)
+        {
+            insert_extent(as, first_page + new_pages, rest);
+        }
+    }
+    pthread_mutex_unlock(&extent_lock);
+    if (in_place)
+    {
+        map_pages(as, first_page + old_pages, extra, true);
+        return va;
+    }
+
+    // large pages move whole when the new range keeps their offset
+    unsigned long lead = first_page % LARGE_PAGE_FRAMES;
+    bool large = old_pages >= LARGE_PAGE_FRAMES;
+    unsigned long start = get_aligned_avail(as, new_pages + (large ? lead : 0), large ? LARGE_PAGE_FRAMES : 1);
+    if (large && lead > 0)
+    {
+        release_virtual(start, lead);
+        start += lead;
+    }
+    move_pages(as, first_page, start, old_pages);
+    map_pages(as, start + old_pages, extra, true);
+    shootdown_TLB(first_page, old_pages);
+    release_virtual(first_page, old_pages);
+    return (void *)(start << PGSHIFT);
+}
+
+/*
+Takes PD_FRAMES contiguous frames for a page directory with every entry -1,
+or returns -1. A directory of several frames is cut from the run of a
+large page, the rest of which goes straight back.
+*/
+static long new_directory()
+{
+    long pa;
+    if (PD_FRAMES == 1)
+    {
+        pa = get_next_page();
+    }
+    else if ((pa = get_large_frames()) >= 0)
+    {
+        free_frames(pa + PD_FRAMES * PGSIZE, LARGE_PAGE_FRAMES - PD_FRAMES);
+    }
+    if (pa >= 0)
+    {
+        memset(&physical_memory[pa], -1, PD_FRAMES * PGSIZE);
+        STAT_ADD(tables_allocated, PD_FRAMES);
+    }
+    return pa;
+}
+
+/*
+Shares the page at index of the page table at table, which maps vpn in
+parent, with copy, the same table of a new space, making both entries copy
+on write. The entry is held busy so no eviction, fault or copy is halfway
+through it, and a swapped out page is brought back in first since shared
+frames are not evicted. A frame that was not evictable, a slab page, is
+marked PTE_WIRED to stay resident once it is copied. A pinned page cannot
+be copy on write, since it is written through host pointers, so copy gets
+a copy of it right away, which stays resident.
+*/
+static void share_page(struct address_space *parent, pde_t table, pde_t copy, unsigned long index, unsigned long vpn)
+{
+    pte_t pte = load_entry(table, index);
+    while (pte != (pte_t)-1)
+    {
+        if (pte & PTE_BUSY)
+        {
+            sched_yield();
+        }
+        else if (pte & PTE_SWAPPED)
+        {
+            fault_in(parent, table, index, vpn, pte);
+        }
+        else if (publish_entry(table, index, pte, pte | PTE_BUSY))
+        {
+            break;
+        }
+        pte = load_entry(table, index);
+    }
+    if (pte == (pte_t)-1)
+    {
+        return;
+    }
+
+    long pa = pte & ~PTE_FLAGS;
+    if (__atomic_load_n(&frame_pins[pa / PGSIZE], __ATOMIC_ACQUIRE) != 0)
+    {
+        long frame = get_next_page();
+        if (frame < 0)
+        {
+            perror("Ran out of physical memory");
+            exit(1);
+        }
+        memcpy(&physical_memory[frame], &physical_memory[pa], PGSIZE);
+        store_entry(copy, index, frame | PTE_ACCESSED | PTE_DIRTY);
+        store_entry(table, index, pte);
+        return;
+    }
+    pte_t shared = pa | PTE_COW | (pte & PTE_WIRED);
+    if (!(pte & PTE_COW))
+    {
+        if (__atomic_load_n(&frame_owner[pa / PGSIZE], __ATOMIC_RELAXED) == 0)
+        {
+            shared |= PTE_WIRED;
+        }
+        disown_frame(pa);
+        free_slot(frame_slot[pa / PGSIZE]); // the frame is never written to it now
+        frame_slot[pa / PGSIZE] = 0;
+    }
+    share_frame(pa, 1);
+    store_entry(copy, index, shared);
+    store_entry(table, index, shared);
+}
+
+// Whether t_pin() holds any of count frames from pa
+static bool frames_pinned(long pa, unsigned long count)
+{
+    for (unsigned long i = 0; i < count; i++)
+    {
+        if (__atomic_load_n(&frame_pins[pa / PGSIZE + i], __ATOMIC_ACQUIRE) != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Copies the large page at pa for a new space and returns the entry mapping
+the copy: a large page again when an aligned run of frames is free, a
+page table of resident small pages otherwise.
+*/
+static pde_t copy_large(long pa)
+{
+    long copy = get_large_frames();
+    if (copy >= 0)
+    {
+        memcpy(&physical_memory[copy], &physical_memory[pa], LARGE_PAGE_SIZE);
+        return copy | PDE_LARGE;
+    }
+    pde_t pg_tbl = new_table();
+    for (unsigned long i = 0; i < LARGE_PAGE_FRAMES; i++)
+    {
+        long frame = get_next_page();
+        if (frame < 0)
+        {
+            perror("Ran out of physical memory");
+            exit(1);
+        }
+        memcpy(&physical_memory[frame], &physical_memory[pa + i * PGSIZE], PGSIZE);
+        store_entry(pg_tbl, i, frame | PTE_ACCESSED | PTE_DIRTY);
+    }
+    return pg_tbl;
+}
+
+/*
+Fills copy, a fresh table at level of a new space, from table, the same
+table of parent covering the virtual pages from first on: tables below it
+are copied and every page they map is shared, but for pinned large pages,
+which are copied.
+*/
+static void clone_table(struct address_space *parent, pde_t table, pde_t copy, int level, unsigned long first)
+{
+    unsigned long entries = level == 0 ? PAGE_DIRECTORY_SIZE : PAGE_TABLE_SIZE;
+    for (unsigned long i = 0; i < entries; i++)
+    {
+        unsigned long vpn = first + i * level_span(level);
+        if (level == PT_LEVELS - 1)
+        {
+            share_page(parent, table, copy, i, vpn);
+            continue;
+        }
+        pde_t entry = load_entry(table, i);
+        if (entry == (pde_t)-1)
+        {
+            continue;
+        }
+        if (entry & PDE_LARGE)
+        {
+            long pa = entry & ~PDE_FLAGS;
+            if (!(entry & PDE_COW) && frames_pinned(pa, LARGE_PAGE_FRAMES))
+            {
+                store_entry(copy, i, copy_large(pa));
+                continue;
+            }
+            share_frame(pa, LARGE_PAGE_FRAMES);
+            store_entry(copy, i, pa | PDE_LARGE | PDE_COW);
+            store_entry(table, i, pa | PDE_LARGE | PDE_COW);
+            continue;
+        }
+        pde_t next = new_table();
+        clone_table(parent, entry, next, level + 1, vpn);
+        store_entry(copy, i, next);
+    }
+}
+
+// Unmaps every page below table at level, leaving the tables to free_tables()
+static void clear_table(pde_t table, int level)
+{
+    unsigned long entries = level == 0 ? PAGE_DIRECTORY_SIZE : PAGE_TABLE_SIZE;
+    for (unsigned long i = 0; i < entries; i++)
+    {
+        if (level == PT_LEVELS - 1)
+        {
+            pte_t pte = clear_entry(table, i);
+            long pa = pte == (pte_t)-1 ? -1 : release_entry(pte);
+            if (pa >= 0)
+            {
+                free_frames(pa, 1);
+            }
+            continue;
+        }
+        pde_t entry = load_entry(table, i);
+        if (entry == (pde_t)-1)
+        {
+            continue;
+        }
+        if (entry & PDE_LARGE)
+        {
+            store_entry(table, i, (pde_t)-1);
+            long pa = release_large(entry);
+            if (pa >= 0)
+            {
+                free_frames(pa, LARGE_PAGE_FRAMES);
+            }
+            continue;
+        }
+        clear_table(entry, level + 1);
+    }
+}
+
+// Frees the tables below table at level
+static void free_tables(pde_t table, int level)
+{
+    unsigned long entries = level == 0 ? PAGE_DIRECTORY_SIZE : PAGE_TABLE_SIZE;
+    for (unsigned long i = 0; i < entries; i++)
+    {
+        pde_t entry = load_entry(table, i);
+        if (entry == (pde_t)-1)
+        {
+            continue;
+        }
+        if (level + 1 < PT_LEVELS - 1)
+        {
+            free_tables(entry, level + 1);
+        }
+        free_page(entry);
+        STAT_ADD(tables_freed, 1);
+    }
+}
+
+/*
+Makes a new address space that starts as a copy of the calling thread's:
+the same mappings, free virtual pages and partial slabs. Only the page
+tables are copied. Frames are shared copy on write with a count per frame,
+and whichever space writes to a page first gets its own copy. Pages that
+are swapped out are brought back in first, and shared pages stay resident
+until they are written or freed. Other threads may keep reading and writing
+the space meanwhile, but must not allocate or free in it. Returns the new
+space for t_switch(), or -1 when MAX_SPACES are live or no frames are left
+for its directory.
+*/
+int t_clone()
+{
+    pthread_once(&vm_once, init_vm);
+    struct address_space *parent = current_space();
+
+    lock_mutex(&space_lock);
+    int id = 1;
+    while (id < MAX_SPACES && spaces[id] != NULL)
+    {
+        id++;
+    }
+    long directory = id < MAX_SPACES ? new_directory() : -1;
+    if (directory < 0)
+    {
+        pthread_mutex_unlock(&space_lock);
+        return -1;
+    }
+    struct address_space *child = (struct address_space *)calloc(1, sizeof(struct address_space));
+    if (child == NULL)
+    {
+        perror("Failed to allocate address space");
+        exit(1);
+    }
+    child->id = id;
+    child->directory = directory;
+
+    lock_mutex(&extent_lock);
+    for (int cls = 0; cls < EXTENT_CLASSES; cls++)
+    {
+        for (struct extent *e = parent->extent_classes[cls]; e != NULL; e = e->next)
+        {
+            insert_extent(child, e->start, e->pages);
+        }
+    }
+    pthread_mutex_unlock(&extent_lock);
+    for (int cls = 0; cls < SLAB_CLASSES; cls++)
+    {
+        lock_mutex(&slab_locks[cls]);
+        child->slab_partial[cls] = parent->slab_partial[cls];
+        child->slab_spare[cls] = parent->slab_spare[cls];
+        pthread_mutex_unlock(&slab_locks[cls]);
+    }
+
+    clone_table(parent, parent->directory, child->directory, 0, 0);
+
+    // writable translations of the parent go, and copies through them finish
+    wait_for_accesses(shootdown_TLB(0, NUM_VIRTUAL_PAGES));
+    spaces[id] = child;
+    pthread_mutex_unlock(&space_lock);
+    return id;
+}
+
+/*
+Moves the calling thread to address space space, 0 being the initial one.
+Its TLB is flushed the next time it translates an address or caches a
+translation. Other threads stay where they are, and new threads start in
+space 0. Returns 0, or -1 if there is no such space.
+*/
+int t_switch(int space)
+{
+    lock_mutex(&space_lock);
+    struct address_space *as = space >= 0 && space < MAX_SPACES ? spaces[space] : NULL;
+    pthread_mutex_unlock(&space_lock);
+    if (as == NULL)
+    {
+        return -1;
+    }
+    thread_space = as == &initial_space ? NULL : as;
+    return 0;
+}
+
+/*
+Tears an address space made by t_clone() down: its pages and swap slots go
+back, except for frames other spaces still share, and so do its page
+tables and free extents. No thread may be working in it, so the initial
+space and the caller's own cannot go. Returns 0, or -1 if there is no
+such space or it is the caller's.
+*/
+int t_destroy(int space)
+{
+    lock_mutex(&space_lock);
+    struct address_space *as = space > 0 && space < MAX_SPACES ? spaces[space] : NULL;
+    if (as == NULL || as == current_space())
+    {
+        pthread_mutex_unlock(&space_lock);
+        return -1;
+    }
+
+    // its pages still queued for reading ahead are dropped and the batch
+    // being read finishes
+    lock_mutex(&prefetch_lock);
+    for (unsigned long i = prefetch_head; i != prefetch_tail; i++)
+    {
+        if (prefetch_queue[i % PREFETCH_QUEUE].space == as)
+        {
+            prefetch_queue[i % PREFETCH_QUEUE].space = NULL;
+        }
+    }
+    for (int i = 0; i < PREFETCH_STREAMS; i++)
+    {
+        if (fault_streams[i].space == as)
+        {
+            fault_streams[i].space = NULL;
+            fault_streams[i].stamp = 0;
+        }
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+    lock_mutex(&prefetch_run_lock);
+    pthread_mutex_unlock(&prefetch_run_lock);
+
+    // the merge scanner finishes its round and forgets the pages it saw
+    lock_mutex(&merge_lock);
+    memset(merge_table, 0, sizeof(merge_table));
+    pthread_mutex_unlock(&merge_lock);
+
+    clear_table(as->directory, 0);
+
+    // an evictor may still be walking the tables to a frame it chose before
+    lock_mutex(&evict_lock);
+    pthread_mutex_unlock(&evict_lock);
+    free_tables(as->directory, 0);
+    free_frames(as->directory, PD_FRAMES);
+    STAT_ADD(tables_freed, PD_FRAMES);
+
+    lock_mutex(&extent_lock);
+    for (int cls = 0; cls < EXTENT_CLASSES; cls++)
+    {
+        while (as->extent_classes[cls] != NULL)
+        {
+            remove_extent(as, as->extent_classes[cls]);
+        }
+    }
+    pthread_mutex_unlock(&extent_lock);
+
+    // no TLB may take a later space at the same address for this one
+    shootdown_TLB(0, NUM_VIRTUAL_PAGES);
+    spaces[space] = NULL;
+    pthread_mutex_unlock(&space_lock);
+    free(as);
+    return 0;
+}
+
+/*
+Accumulates one tile of the product: rows [i0, i1) of c gain
+a[i][k0..k1) * b[k0..k1)[j0..j1), with that block of b packed row by row
+into panel at a stride of MAT_TILE. Each row's MAT_BLOCK columns of c stay
+in vector accumulators for the whole k loop while the panel rows stream
+past, multiplied by a broadcast element of a. Columns that do not fill a
+block are finished with scalar code.
+*/
+static void mat_tile(const unsigned int *a, const unsigned int *panel, unsigned int *c, int size, int i0, int i1,
+                     int k0, int k1, int j0, int j1)
+{
+    for (int i = i0; i < i1; i++)
+    {
+        unsigned int *c_row = &c[(unsigned long)i * size];
+        const unsigned int *a_row = &a[(unsigned long)i * size];
+        int j = j0;
+        for (; j + MAT_BLOCK <= j1; j += MAT_BLOCK)
+        {
+            mat_vec acc0, acc1, acc2, acc3;
+            memcpy(&acc0, &c_row[j], sizeof(mat_vec));
+            memcpy(&acc1, &c_row[j + MAT_LANES], sizeof(mat_vec));
+            memcpy(&acc2, &c_row[j + 2 * MAT_LANES], sizeof(mat_vec));
+            memcpy(&acc3, &c_row[j + 3 * MAT_LANES], sizeof(mat_vec));
+            for (int k = k0; k < k1; k++)
+            {
+                const unsigned int *b_row = &panel[(k - k0) * MAT_TILE + (j - j0)];
+                mat_vec a_vec = (mat_vec){0} + a_row[k];
+                mat_vec b0, b1, b2, b3;
+                memcpy(&b0, &b_row[0], sizeof(mat_vec));
+                memcpy(&b1, &b_row[MAT_LANES], sizeof(mat_vec));
+                memcpy(&b2, &b_row[2 * MAT_LANES], sizeof(mat_vec));
+                memcpy(&b3, &b_row[3 * MAT_LANES], sizeof(mat_vec));
+                acc0 += a_vec * b0;
+                acc1 += a_vec * b1;
+                acc2 += a_vec * b2;
+                acc3 += a_vec * b3;
+            }
+            memcpy(&c_row[j], &acc0, sizeof(mat_vec));
+            memcpy(&c_row[j + MAT_LANES], &acc1, sizeof(mat_vec));
+            memcpy(&c_row[j + 2 * MAT_LANES], &acc2, sizeof(mat_vec));
+            memcpy(&c_row[j + 3 * MAT_LANES], &acc3, sizeof(mat_vec));
+        }
+        for (; j < j1; j++)
+        {
+            unsigned int sum = c_row[j];
+            for (int k = k0; k < k1; k++)
+            {
+                sum += a_row[k] * panel[(k - k0) * MAT_TILE + (j - j0)];
+            }
+            c_row[j] = sum;
+        }
+    }
+}
+
+/*
+Copies one band of MAT_TILE rows of both operands into the host buffers,
+or of the result back out when store is set. The copy goes through the
+calling worker's own TLB.
+*/
+static void mat_copy_band(struct mat_job *job, unsigned long band, bool store)
+{
+    int r0 = (int)band * MAT_TILE;
+    int r1 = r0 + MAT_TILE < job->size ? r0 + MAT_TILE : job->size;
+    unsigned long first = (unsigned long)r0 * job->size;
+    unsigned long bytes = (unsigned long)(r1 - r0) * job->size * sizeof(unsigned int);
+    unsigned long offset = first * sizeof(unsigned int);
+    struct page_hint last = {0};
+    int failed;
+    if (store)
+    {
+        failed = copy_virtual(job->space, job->answer + offset, (char *)&job->c[first], bytes, true, &last, 1);
+    }
+    else
+    {
+        failed = copy_virtual(job->space, job->mat1 + offset, (char *)&job->a[first], bytes, false, &last, 1) ||
+                 copy_virtual(job->space, job->mat2 + offset, (char *)&job->b[first], bytes, false, &last, 1);
+    }
+    if (failed)
+    {
+        perror("Invalid virtual address");
+        exit(1);
+    }
+}
+
+static void mat_load_band(struct mat_job *job, unsigned long band)
+{
+    mat_copy_band(job, band, false);
+}
+
+static void mat_store_band(struct mat_job *job, unsigned long band)
+{
+    mat_copy_band(job, band, true);
+}
+
+/*
+Computes one MAT_TILE x MAT_TILE tile of the result over the whole k range,
+packing the blocks of b it needs into a panel of its own. Tiles are
+numbered row by row, so neighbouring tasks share their rows of a.
+*/
+static void mat_multiply_tile(struct mat_job *job, unsigned long task)
+{
+    int size = job->size;
+    int i0 = (int)(task / job->tiles) * MAT_TILE;
+    int j0 = (int)(task % job->tiles) * MAT_TILE;
+    int i1 = i0 + MAT_TILE < size ? i0 + MAT_TILE : size;
+    int j1 = j0 + MAT_TILE < size ? j0 + MAT_TILE : size;
+    unsigned int panel[MAT_TILE * MAT_TILE];
+    for (int k0 = 0; k0 < size; k0 += MAT_TILE)
+    {
+        int k1 = k0 + MAT_TILE < size ? k0 + MAT_TILE : size;
+        for (int k = k0; k < k1; k++)
+        {
+            memcpy(&panel[(k - k0) * MAT_TILE], &job->b[(unsigned long)k * size + j0],
+                   (j1 - j0) * sizeof(unsigned int));
+        }
+        mat_tile(job->a, panel, job->c, size, i0, i1, k0, k1, j0, j1);
+    }
+}
+
+/*
+Runs tasks of the current phase until every queue is empty: first the
+worker's own, then the others' starting from its neighbour.
+*/
+static void mat_drain(int id)
+{
+    struct mat_job *job = mat_current;
+    int workers = mat_round_workers;
+    for (int i = 0; i < workers; i++)
+    {
+        struct mat_queue *q = &mat_queues[(id + i) % workers];
+        for (;;)
+        {
+            unsigned long task = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+            if (task >= q->end)
+            {
+                break;
+            }
+            job->run(job, task);
+        }
+    }
+}
+
+// Body of a helper thread: runs every phase it is counted in, then sleeps
+static void *mat_worker(void *arg)
+{
+    int id = (int)(long)arg;
+    unsigned long seen = 0;
+    for (;;)
+    {
+        lock_mutex(&mat_wake_lock);
+        while (mat_round == seen)
+        {
+            pthread_cond_wait(&mat_wake, &mat_wake_lock);
+        }
+        seen = mat_round;
+        bool joined = id < mat_round_workers;
+        pthread_mutex_unlock(&mat_wake_lock);
+        if (!joined)
+        {
+            continue;
+        }
+
+        mat_drain(id);
+
+        lock_mutex(&mat_wake_lock);
+        if (--mat_active == 0)
+        {
+            pthread_cond_signal(&mat_done);
+        }
+        pthread_mutex_unlock(&mat_wake_lock);
+    }
+    return NULL;
+}
+
+/*
+Splits tasks [0, tasks) into one contiguous queue per worker, wakes the
+helpers, works on the phase from the calling thread and returns once all of
+them are finished. Caller must hold mat_pool_lock.
+*/
+static void mat_run_phase(struct mat_job *job, void (*run)(struct mat_job *, unsigned long), unsigned long tasks,
+                          int workers)
+{
+    job->run = run;
+    for (int i = 0; i < workers; i++)
+    {
+        mat_queues[i].next = tasks * i / workers;
+        mat_queues[i].end = tasks * (i + 1) / workers;
+    }
+
+    lock_mutex(&mat_wake_lock);
+    mat_current = job;
+    mat_round_workers = workers;
+    mat_active = workers - 1;
+    mat_round++;
+    pthread_cond_broadcast(&mat_wake);
+    pthread_mutex_unlock(&mat_wake_lock);
+
+    mat_drain(0);
+
+    lock_mutex(&mat_wake_lock);
+    while (mat_active > 0)
+    {
+        pthread_cond_wait(&mat_done, &mat_wake_lock);
+    }
+    pthread_mutex_unlock(&mat_wake_lock);
+}
+
+/*
+Starts helper threads until the pool has workers of them, counting the
+caller. Caller must hold mat_pool_lock.
+*/
+static void mat_grow_pool(int workers)
+{
+    while (mat_pool_size < workers)
+    {
+        if (pthread_create(&mat_workers[mat_pool_size], NULL, mat_worker, (void *)(long)mat_pool_size) != 0)
+        {
+            perror("Failed to start matrix worker");
+            exit(1);
+        }
+        pthread_detach(mat_workers[mat_pool_size]);
+        mat_pool_size++;
+    }
+}
+
+/*
+Sets how many threads mat_mult() uses, counting the calling thread. With
+more than one, multiplies larger than a single tile run on a persistent
+pool of worker threads that is grown on first use. Returns 0 on success and
+-1 if threads is not between 1 and MAT_MAX_THREADS.
+*/
+int set_mat_threads(int threads)
+{
+    if (threads < 1 || threads > MAT_MAX_THREADS)
+    {
+        return -1;
+    }
+    __atomic_store_n(&mat_threads, threads, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+This function receives two matrices mat1 and mat2 as an argument with size
+argument representing the number of rows and columns. After performing matrix
+multiplication, copy the result to answer.
+The operands are copied out a band of MAT_TILE rows at a time, so every page
+is translated once, and the product is computed one MAT_TILE x MAT_TILE
+tile at a time. That runs on the calling thread unless set_mat_threads()
+asked for more and the matrix spans several tiles. Arithmetic is unsigned
+int and wraps, so the result matches the element by element definition
+exactly.
+*/
+void mat_mult(void *mat1, void *mat2, int size, void *answer)
+{
+
+    /* Hint: You will index as [i * size + j] where  "i, j" are the indices of the
+     * matrix accessed. Similar to the code in test.c, you will use get_value() to
+     * load each element and perform multiplication. Take a look at test.c! In addition to
+     * getting the values from two matrices, you will perform multiplication and
+     * store the result to the "answer array"
+     */
+    unsigned long bytes = (unsigned long)size * size * sizeof(unsigned int);
+    struct mat_job job;
+    job.space = current_space();
+    job.mat1 = (unsigned long)mat1;
+    job.mat2 = (unsigned long)mat2;
+    job.answer = (unsigned long)answer;
+    job.size = size;
+    job.tiles = (size + MAT_TILE - 1) / MAT_TILE;
+    job.a = (unsigned int *)malloc(bytes);
+    job.b = (unsigned int *)malloc(bytes);
+    job.c = (unsigned int *)calloc((unsigned long)size * size, sizeof(unsigned int));
+    if (job.a == NULL || job.b == NULL || job.c == NULL)
+    {
+        perror("Failed to allocate matrix buffers");
+        exit(1);
+    }
+
+    // Load the operands band by band, compute the result tile by tile and
+    // store it band by band. On the pool every worker translates through its
+    // own TLB on the lock free page walk, so the phases only meet at their ends.
+    unsigned long tiles = (unsigned long)job.tiles * job.tiles;
+    int workers = __atomic_load_n(&mat_threads, __ATOMIC_RELAXED);
+    if (workers == 1 || job.tiles == 1)
+    {
+        for (unsigned long band = 0; band < (unsigned long)job.tiles; band++)
+        {
+            mat_load_band(&job, band);
+        }
+        for (unsigned long tile = 0; tile < tiles; tile++)
+        {
+            mat_multiply_tile(&job, tile);
+        }
+        for (unsigned long band = 0; band < (unsigned long)job.tiles; band++)
+        {
+            mat_store_band(&job, band);
+        }
+    }
+    else
+    {
+        lock_mutex(&mat_pool_lock);
+        mat_grow_pool(workers);
+        mat_run_phase(&job, mat_load_band, job.tiles, workers);
+        mat_run_phase(&job, mat_multiply_tile, tiles, workers);
+        mat_run_phase(&job, mat_store_band, job.tiles, workers);
+        pthread_mutex_unlock(&mat_pool_lock);
+    }
+
+    free(job.a);
+    free(job.b);
+    free(job.c);
+}
+
+/*
+Selects the TLB geometry and replacement policy. ways must divide entries
+and both must be powers of two; ways == entries gives a fully associative
+TLB. Every thread's TLB is rebuilt empty on its next use and the hit and
+miss counters restart, so this is meant to be called at init time.
+Returns 0 on success and -1 for an unsupported geometry.
+*/
+int set_TLB_config(unsigned int entries, unsigned int ways, enum tlb_policy policy)
+{
+    if (entries == 0 || ways == 0 || ways > entries || (entries & (entries - 1)) != 0 ||
+        (ways & (ways - 1)) != 0)
+    {
+        return -1;
+    }
+    lock_mutex(&tlb_registry_lock);
+    tlb_config_entries = entries;
+    tlb_config_ways = ways;
+    tlb_config_policy = policy;
+    __atomic_store_n(&tlb_config_version, tlb_config_version + 1, __ATOMIC_RELAXED);
+    for (struct TLB *t = all_tlbs; t != NULL; t = t->next)
+    {
+        __atomic_store_n(&t->hits, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&t->misses, 0, __ATOMIC_RELAXED);
+    }
+    retired_hits = 0;
+    retired_misses = 0;
+    pthread_mutex_unlock(&tlb_registry_lock);
+    return 0;
+}
+
+/*
+Returns the way of set holding vpn, or -1. Four packed tags are compared per
+vector operation.
+*/
+static int tlb_lookup(struct TLB *t, unsigned long set, uint64_t vpn)
+{
+    const uint64_t *tags = &t->tags[set * t->ways];
+    unsigned int way = 0;
+    tlb_tag_vec key = {vpn, vpn, vpn, vpn};
+    for (; way + 4 <= t->ways; way += 4)
+    {
+        tlb_tag_vec packed;
+        memcpy(&packed, &tags[way], sizeof(packed));
+        tlb_tag_vec hit = packed == key;
+        if ((hit[0] | hit[1] | hit[2] | hit[3]) != 0)
+        {
+            return way + (hit[0] ? 0 : hit[1] ? 1 : hit[2] ? 2 : 3);
+        }
+    }
+    for (; way < t->ways; way++)
+    {
+        if (tags[way] == vpn)
+        {
+            return way;
+        }
+    }
+    return -1;
+}
+
+// Records a use of a way for the replacement policy
+static void tlb_touch(struct TLB *t, unsigned long set, unsigned int way)
+{
+    unsigned long entry = set * t->ways + way;
+    switch (t->policy)
+    {
+    case TLB_LRU:
+        t->stamps[entry] = ++t->tick;
+        break;
+    case TLB_PLRU:
+    {
+        // point every node on the path away from the way just used
+        uint8_t *tree = &t->plru[set * t->ways];
+        unsigned int node = 1;
+        for (unsigned int half = t->ways / 2; half > 0; half /= 2)
+        {
+            unsigned int right = (way & half) != 0;
+            tree[node] = !right;
+            node = node * 2 + right;
+        }
+        break;
+    }
+    case TLB_CLOCK:
+        t->referenced[entry] = 1;
+        break;
+    case TLB_RANDOM:
+        break;
+    }
+}
+
+// Picks the way of a full set to replace
+static unsigned int tlb_victim(struct TLB *t, unsigned long set)
+{
+    unsigned long base = set * t->ways;
+    switch (t->policy)
+    {
+    case TLB_LRU:
+    {
+        unsigned int victim = 0;
+        for (unsigned int way = 1; way < t->ways; way++)
+        {
+            if (t->stamps[base + way] < t->stamps[base + victim])
+            {
+                victim = way;
+            }
+        }
+        return victim;
+    }
+    case TLB_PLRU:
+    {
+        uint8_t *tree = &t->plru[base];
+        unsigned int node = 1, way = 0;
+        for (unsigned int half = t->ways / 2; half > 0; half /= 2)
+        {
+            way = way * 2 + tree[node];
+            node = node * 2 + tree[node];
+        }
+        return way;
+    }
+    case TLB_CLOCK:
+    {
+        unsigned int *hand = &t->hands[set];
+        while (t->referenced[base + *hand])
+        {
+            t->referenced[base + *hand] = 0;
+            *hand = (*hand + 1) % t->ways;
+        }
+        unsigned int victim = *hand;
+        *hand = (*hand + 1) % t->ways;
+        return victim;
+    }
+    case TLB_RANDOM:
+        t->seed ^= t->seed << 13;
+        t->seed ^= t->seed >> 7;
+        t->seed ^= t->seed << 17;
+        return t->seed % t->ways;
+    }
+    return 0;
+}
+
+/*
+Returns the large TLB entry holding large page number lpn, or -1. The tags
+are compared four at a time like in tlb_lookup().
+*/
+static int large_tlb_lookup(struct TLB *t, uint64_t lpn)
+{
+    tlb_tag_vec key = {lpn, lpn, lpn, lpn};
+    for (unsigned int i = 0; i < LARGE_TLB_ENTRIES; i += 4)
+    {
+        tlb_tag_vec packed;
+        memcpy(&packed, &t->large_tags[i], sizeof(packed));
+        tlb_tag_vec hit = packed == key;
+        if ((hit[0] | hit[1] | hit[2] | hit[3]) != 0)
+        {
+            return i + (hit[0] ? 0 : hit[1] ? 1 : hit[2] ? 2 : 3);
+        }
+    }
+    return -1;
+}
+
+/*
+Caches the translation of large page number lpn in as to the large page at
+pa, replacing the least recently used entry when the large TLB is full.
+*/
+static void add_large_TLB(struct address_space *as, unsigned long lpn, unsigned long pa)
+{
+    struct TLB *t = get_TLB();
+    tag_TLB(t, as);
+    int entry = large_tlb_lookup(t, lpn);
+    if (entry < 0)
+    {
+        entry = 0;
+        for (int i = 1; i < LARGE_TLB_ENTRIES; i++)
+        {
+            if (t->large_stamps[i] < t->large_stamps[entry])
+            {
+                entry = i;
+            }
+        }
+    }
+    t->large_tags[entry] = lpn;
+    t->large_frames[entry] = pa;
+    t->large_stamps[entry] = ++t->tick;
+}
+
+/*
+Caches the translation of vpn to frame, the physical address of the page
+possibly with TLB_DIRTY set, in t.
+*/
+static void fill_TLB(struct TLB *t, uint64_t vpn, unsigned long frame)
+{
+    unsigned long set = vpn & (t->sets - 1);
+
+    int way = tlb_lookup(t, set, vpn);
+    if (way < 0)
+    {
+        way = tlb_lookup(t, set, TLB_INVALID);
+    }
+    if (way < 0)
+    {
+        way = tlb_victim(t, set);
+    }
+
+    unsigned long entry = set * t->ways + way;
+    t->tags[entry] = vpn;
+    t->frames[entry] = frame;
+    tlb_touch(t, set, way);
+}
+
+/*
+ * Part 2: Add a virtual to physical page translation to the TLB.
+ * Feel free to extend the function arguments or return type.
+ * pa is the physical address of the page holding va.
+ * @Author - Taj
+ */
+int add_TLB(void *va, void *pa)
+{
+
+    /*Part 2 HINT: Add a virtual to physical page translation to the TLB */
+    struct TLB *t = get_TLB();
+    tag_TLB(t, current_space());
+    fill_TLB(t, (unsigned long)va >> PGSHIFT, (unsigned long)pa);
+    return 1;
+}
+
+/*
+Looks vpn up in both TLBs of t and returns the physical address of its
+page, or -1. dirty tells whether writes may go ahead without marking the
+page table entry first, which large pages never need.
+*/
+static pte_t lookup_TLB(struct TLB *t, uint64_t vpn, bool *dirty)
+{
+    unsigned long set = vpn & (t->sets - 1);
+    int way = tlb_lookup(t, set, vpn);
+    if (way >= 0)
+    {
+        tlb_touch(t, set, way);
+        unsigned long frame = t->frames[set * t->ways + way];
+        *dirty = (frame & TLB_DIRTY) != 0;
+        return frame & ~TLB_DIRTY;
+    }
+
+    int large = large_tlb_lookup(t, vpn / LARGE_PAGE_FRAMES);
+    if (large >= 0)
+    {
+        t->large_stamps[large] = ++t->tick;
+        *dirty = true;
+        return t->large_frames[large] + (vpn % LARGE_PAGE_FRAMES) * PGSIZE;
+    }
+    return -1;
+}
+
+/*
+ * Part 2: Check TLB for a valid translation.
+ * Returns the physical page address.
+ * Feel free to extend this function and change the return type.
+ * @Author - Taj
+ */
+pte_t *check_TLB(void *va)
+{
+
+    /* Part 2: TLB lookup code here */
+    bool dirty;
+    pte_t page = lookup_TLB(get_TLB(), (unsigned long)va >> PGSHIFT, &dirty);
+
+    /*This function should return a pte_t pointer*/
+    return page == (pte_t)-1 ? NULL : (pte_t *)page;
+}
+
+/*
+Drops the translation for the page holding va from every thread's TLB.
+*/
+void remove_TLB(void *va)
+{
+    shootdown_TLB((unsigned long)va >> PGSHIFT, 1);
+}
+
+/*
+ * Part 2: Print TLB miss rate.
+ * Feel free to extend the function arguments or return type.
+ * @Author - Taj
+ */
+void print_TLB_missrate()
+{
+    /*Part 2 Code here to calculate and print the TLB miss rate*/
+    lock_mutex(&tlb_registry_lock);
+    unsigned long hits = retired_hits;
+    unsigned long misses = retired_misses;
+    for (struct TLB *t = all_tlbs; t != NULL; t = t->next)
+    {
+        hits += __atomic_load_n(&t->hits, __ATOMIC_RELAXED);
+        misses += __atomic_load_n(&t->misses, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&tlb_registry_lock);
+
+    double miss_rate = 0;
+    miss_rate = (double)misses / (hits + misses);
+    fprintf(stderr, "hits: %lu \n", hits);
+    fprintf(stderr, "misses: %lu \n", misses);
+    fprintf(stderr, "TLB miss rate %lf \n", miss_rate);
+}
+#ifndef VM_NO_STATS
+// Adds the counters of s, which its thread may be updating, to total
+static void add_stats(struct vm_stats *total, const struct vm_stats *s)
+{
+    total->tlb_hits += __atomic_load_n(&s->tlb_hits, __ATOMIC_RELAXED);
+    total->tlb_misses += __atomic_load_n(&s->tlb_misses, __ATOMIC_RELAXED);
+    total->page_walks += __atomic_load_n(&s->page_walks, __ATOMIC_RELAXED);
+    total->frames_allocated += __atomic_load_n(&s->frames_allocated, __ATOMIC_RELAXED);
+    total->frames_freed += __atomic_load_n(&s->frames_freed, __ATOMIC_RELAXED);
+    total->tables_allocated += __atomic_load_n(&s->tables_allocated, __ATOMIC_RELAXED);
+    total->tables_freed += __atomic_load_n(&s->tables_freed, __ATOMIC_RELAXED);
+    total->lock_waits += __atomic_load_n(&s->lock_waits, __ATOMIC_RELAXED);
+    total->lock_wait_ns += __atomic_load_n(&s->lock_wait_ns, __ATOMIC_RELAXED);
+    for (int op = 0; op < VM_OPS; op++)
+    {
+        const struct vm_histogram *from = &s->latency[op];
+        struct vm_histogram *hist = &total->latency[op];
+        total->calls[op] += __atomic_load_n(&s->calls[op], __ATOMIC_RELAXED);
+        hist->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+        hist->sum_ns += __atomic_load_n(&from->sum_ns, __ATOMIC_RELAXED);
+        unsigned long max_ns = __atomic_load_n(&from->max_ns, __ATOMIC_RELAXED);
+        if (max_ns > hist->max_ns)
+        {
+            hist->max_ns = max_ns;
+        }
+        for (int b = 0; b < VM_HIST_BUCKETS; b++)
+        {
+            hist->buckets[b] += __atomic_load_n(&from->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+#endif
+
+/*
+Fills in the counters and latency histograms of every thread since
+startup, those that exited included. Each thread's counters are read
+while it goes on updating them, so the totals are a close snapshot
+rather than an exact one.
+*/
+void t_vm_stats(struct vm_stats *stats)
+{
+    memset(stats, 0, sizeof(struct vm_stats));
+#ifndef VM_NO_STATS
+    pthread_mutex_lock(&stats_lock);
+    add_stats(stats, &retired_stats);
+    for (struct thread_stats *st = all_stats; st != NULL; st = st->next)
+    {
+        add_stats(stats, &st->s);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    stats->table_pages = stats->tables_allocated - stats->tables_freed;
+#endif
+}
+
+/*
+Returns the latency below which percentile percent of the timed calls in
+hist fell, as the top of its bucket, or 0 when none were timed.
 */
-void set_physical_mem()
+unsigned long t_vm_percentile(const struct vm_histogram *hist, double percentile)
 {
-    TLB_misses = 0;
-    TLB_hits = 0;
-    // TODO check for seg fault
-    tlb_entries = (struct TLBEntry *)malloc(sizeof(struct TLBEntry) * TLB_ENTRIES);
-    // Initialize the dirct mapped tlb when initializing page tables
-    for (int i = 0; i < TLB_ENTRIES; i++)
+    if (hist->count == 0)
     {
-        tlb_entries[i].physical_page = 0; // no mapping when the entries are empty
-        tlb_entries[i].virtual_page = 0;
-        tlb_entries[i].valid = false;
+        return 0;
     }
-
-    // Allocate physical memory using mmap or malloc; this is the total size of
-    // your memory you are simulating
-    physical_memory = (char *)malloc(sizeof(char) * MEMSIZE);
-
-    if (physical_memory == NULL)
+    unsigned long rank = (unsigned long)(percentile / 100 * hist->count + 0.5);
+    unsigned long seen = 0;
+    for (unsigned int b = 0; b < VM_HIST_BUCKETS - 1; b++)
     {
-        perror("Failed to allocate physical memory");
-        exit(1);
+        seen += hist->buckets[b];
+        if (seen >= rank && seen > 0)
+        {
+            unsigned long top = bucket_floor(b + 1) - 1;
+            return top < hist->max_ns ? top : hist->max_ns;
+        }
     }
+    return hist->max_ns;
+}
 
-    // HINT: Also calculate the number of physical and virtual pages and allocate
-    // virtual and physical bitmaps and initialize them
-    physical_bitmap = (char *)malloc(sizeof(char) * PHYSICAL_BITMAP_SIZE);
-    virtual_bitmap = (char *)malloc(sizeof(char) * VIRTUAL_BITMAP_SIZE);
-
-    if (physical_bitmap == NULL || virtual_bitmap == NULL)
+/*
+Writes the t_vm_stats() counters to out as one line of JSON, with the
+calls, mean, percentiles and maximum of each timed operation in
+nanoseconds.
+*/
+void t_vm_stats_json(FILE *out)
+{
+    static const char *op_names[VM_OPS] = {"t_malloc", "t_free", "put_value", "get_value", "translate"};
+    struct vm_stats *stats = (struct vm_stats *)malloc(sizeof(struct vm_stats));
+    if (stats == NULL)
     {
-        perror("Failed to allocate bitmaps");
-        free(physical_memory); // Clean up allocated memory
+        perror("Failed to allocate statistics");
         exit(1);
     }
+    t_vm_stats(stats);
 
-    // Initialize the bitmaps
-    for (int i = 0; i < PHYSICAL_BITMAP_SIZE; i++)
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(out, "{\"time_ns\":%lu,", (unsigned long)now.tv_sec * 1000000000UL + now.tv_nsec);
+    fprintf(out, "\"tlb_hits\":%lu,\"tlb_misses\":%lu,\"page_walks\":%lu,", stats->tlb_hits, stats->tlb_misses,
+            stats->page_walks);
+    fprintf(out, "\"frames_allocated\":%lu,\"frames_freed\":%lu,", stats->frames_allocated, stats->frames_freed);
+    fprintf(out, "\"tables_allocated\":%lu,\"tables_freed\":%lu,\"table_pages\":%lu,", stats->tables_allocated,
+            stats->tables_freed, stats->table_pages);
+    fprintf(out, "\"lock_waits\":%lu,\"lock_wait_ns\":%lu,\"ops\":{", stats->lock_waits, stats->lock_wait_ns);
+    for (int op = 0; op < VM_OPS; op++)
     {
-        physical_bitmap[i] = 0; // Mark all physical pages as unallocated
-        physical_memory[i] = -1;
+        const struct vm_histogram *hist = &stats->latency[op];
+        fprintf(out, "%s\"%s\":{\"calls\":%lu,\"timed\":%lu,\"mean_ns\":%lu,", op == 0 ? "" : ",", op_names[op],
+                stats->calls[op], hist->count, hist->count == 0 ? 0 : hist->sum_ns / hist->count);
+        fprintf(out, "\"p50_ns\":%lu,\"p90_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu}",
+                t_vm_percentile(hist, 50), t_vm_percentile(hist, 90), t_vm_percentile(hist, 99),
+                t_vm_percentile(hist, 99.9), hist->max_ns);
     }
+    fprintf(out, "}}\n");
+    free(stats);
+}
 
-    for (int i = 0; i < VIRTUAL_BITMAP_SIZE; i++)
+// Stats thread: appends a JSON line to stats_path every stats_interval_ms
+static void *stats_worker(void *arg)
+{
+    (void)arg;
+    for (;;)
     {
-        virtual_bitmap[i] = 0; // Mark all virtual pages as unallocated
-    }
-    virtual_bitmap[0] = 1; // nothing in the first element
+        lock_mutex(&stats_wake_lock);
+        while (stats_interval_ms == 0)
+        {
+            pthread_cond_wait(&stats_wake, &stats_wake_lock);
+        }
+        unsigned int interval_ms = stats_interval_ms;
+        FILE *out = fopen(stats_path, "a");
+        if (out != NULL)
+        {
+            t_vm_stats_json(out);
+            fclose(out);
+        }
+        pthread_mutex_unlock(&stats_wake_lock);
 
-    // calculate offsets
-    page_dir_off = log2(PAGE_DIRECTORY_SIZE);
-    page_tbl_off = log2(PAGE_TABLE_SIZE);
-    page_off = log2(PGSIZE);
+        struct timespec pause = {interval_ms / 1000, (long)(interval_ms % 1000) * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
 }
 
 /*
-The function takes a virtual address and page directories starting address and
-performs translation to return the physical address
-@Author - Advith
+Appends the t_vm_stats_json() line to the file at path every interval_ms
+milliseconds from a thread of its own, started on the first call. A NULL
+path or an interval of 0 stops the dumps. Returns 0, or -1 when path
+cannot be opened for appending.
 */
-pte_t translate(pde_t pgdir, void *va)
+int t_vm_stats_dump(const char *path, unsigned int interval_ms)
 {
-    /* Part 1 HINT: Get the Page directory index (1st level) Then get the
-     * 2nd-level-page table index using the virtual address.  Using the page
-     * directory index and page table index get the physical address.
-     */
-
-    // check tlb cache for a translation
-    void *TLBCheck = check_TLB(va);
-    if (TLBCheck != NULL)
+    char *copy = NULL;
+    if (path != NULL && interval_ms > 0)
     {
-        TLB_hits += 1;
-        return (pte_t)TLBCheck;
+        FILE *out = fopen(path, "a");
+        if (out == NULL)
+        {
+            return -1;
+        }
+        fclose(out);
+        if ((copy = strdup(path)) == NULL)
+        {
+            perror("Failed to allocate statistics path");
+            exit(1);
+        }
     }
-    
-    TLB_misses += 1;
 
-    unsigned long curr_add = (unsigned long)va;
+    lock_mutex(&stats_wake_lock);
+    free(stats_path);
+    stats_path = copy;
+    stats_interval_ms = copy == NULL ? 0 : interval_ms;
+    if (copy != NULL && !stats_started)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, stats_worker, NULL) != 0)
+        {
+            perror("Failed to start the statistics thread");
+            exit(1);
+        }
+        stats_started = true;
+    }
+    pthread_cond_signal(&stats_wake);
+    pthread_mutex_unlock(&stats_wake_lock);
+    return 0;
+}
 
-    pde_t directory_entry = (int)((curr_add >> (page_tbl_off + page_off)));
-    pte_t table_entry = (int)((curr_add >> page_off) & ((1 << page_tbl_off) - 1));
-    long page_entry = (int)(curr_add & ((1 << page_off) - 1));
+// Thread exit: leaves the ring for the flush thread to empty and free
+static void retire_ring(void *arg)
+{
+    struct trace_ring *r = (struct trace_ring *)arg;
+    lock_mutex(&trace_lock);
+    r->retired = true;
+    pthread_mutex_unlock(&trace_lock);
+    thread_ring = NULL;
+}
 
-    pde_t pg_tbl;
-    memcpy(&pg_tbl, &physical_memory[pgdir + directory_entry * sizeof(pde_t)], sizeof(pde_t));
+static void create_trace_key()
+{
+    pthread_key_create(&trace_key, retire_ring);
+}
 
-    // page directory has not been set yet
-    if (pg_tbl == -1)
+// Creates and registers the calling thread's trace ring
+static struct trace_ring *new_ring()
+{
+    pthread_once(&trace_key_once, create_trace_key);
+    struct trace_ring *r = malloc(sizeof(struct trace_ring));
+    if (r == NULL)
     {
-        // Accessing an invalid entry
-        return -1;
+        perror("Failed to allocate a trace ring");
+        exit(1);
     }
+    r->head = 0;
+    r->tail = 0;
+    r->retired = false;
+
+    lock_mutex(&trace_lock);
+    r->thread = trace_threads++;
+    r->next = all_rings;
+    all_rings = r;
+    pthread_mutex_unlock(&trace_lock);
 
-    pte_t page;
-    memcpy(&page, &physical_memory[pg_tbl + table_entry * sizeof(pte_t)], sizeof(pte_t));
+    pthread_setspecific(trace_key, r);
+    thread_ring = r;
+    return r;
+}
 
-    // page table has not been set yet
-    if (page == -1)
+/*
+Appends an access to vpn to the calling thread's trace ring. A full ring
+wakes the flush thread and waits for it, unless tracing stops meanwhile.
+*/
+static void trace_access(unsigned long vpn, bool write)
+{
+    struct trace_ring *r = thread_ring;
+    if (r == NULL)
     {
-        // Accessing an invalid entry
-        return -1;
+        r = new_ring();
+    }
+    unsigned long head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == TRACE_RING)
+    {
+        if (!__atomic_load_n(&trace_on, __ATOMIC_RELAXED))
+        {
+            return;
+        }
+        pthread_cond_signal(&trace_wake);
+        sched_yield();
     }
+    r->entries[head & (TRACE_RING - 1)] = (uint64_t)vpn << 1 | write;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
 
-    // add the translation to TLB
-    add_TLB(va, (void *)(page + page_entry));
-    // return physical address
-    return page + page_entry;
+// Writes entries [from, to) of ring r to the trace file as one block
+static void write_trace_block(struct trace_ring *r, unsigned long from, unsigned long to)
+{
+    uint32_t header[2] = {r->thread, (uint32_t)(to - from)};
+    fwrite(header, sizeof(header), 1, trace_file);
+    fwrite(&r->entries[from & (TRACE_RING - 1)], sizeof(uint64_t), to - from, trace_file);
 }
 
-/*Function that gets the next available virtual address
-@Author - Advith
+/*
+Empties every ring into the trace file, or drops their contents when no
+trace is open, and frees the rings of threads that exited. The caller
+holds trace_lock.
 */
-unsigned long get_next_avail(int num_pages)
+static void flush_rings()
 {
-    bool is_contiguous = true;
-    // Use virtual address bitmap to find the next free page
-    for (unsigned long i = 1; i < VIRTUAL_BITMAP_SIZE; i++)
+    struct trace_ring **link = &all_rings;
+    while (*link != NULL)
     {
-        is_contiguous = true;
-        for (unsigned long j = i; j < num_pages + i; j++)
+        struct trace_ring *r = *link;
+        unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        unsigned long tail = r->tail;
+        if (trace_file != NULL && head != tail)
         {
-            if (virtual_bitmap[j] != 0)
+            // the entries may wrap round the end of the ring
+            unsigned long wrap = (tail | (TRACE_RING - 1)) + 1;
+            if (head > wrap)
             {
-                is_contiguous = false;
+                write_trace_block(r, tail, wrap);
+                tail = wrap;
             }
+            write_trace_block(r, tail, head);
         }
-        if (is_contiguous)
+        __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+
+        if (r->retired && __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == head)
         {
-            return i;
+            *link = r->next;
+            free(r);
+            continue;
         }
+        link = &r->next;
     }
-    perror("Ran out of memory");
-    exit(1);
 }
 
-/*Function that gets the next available physical
-@Author - Advith
-*/
-long get_next_page()
+// Flush thread: empties the rings every TRACE_FLUSH_MS, or sooner when one fills
+static void *trace_worker(void *arg)
 {
-    for (pde_t i = 0; i < PHYSICAL_BITMAP_SIZE; i += PGSIZE)
+    (void)arg;
+    lock_mutex(&trace_lock);
+    for (;;)
     {
-        if (physical_bitmap[i] == 0)
+        while (trace_file == NULL)
+        {
+            pthread_cond_wait(&trace_wake, &trace_lock);
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
         {
-            return i;
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
         }
+        pthread_cond_timedwait(&trace_wake, &trace_lock, &until);
+        flush_rings();
     }
-    perror("Ran out of physical memory");
-    // TODO clean up allocated memory
-    exit(1);
+    return NULL;
 }
 
 /*
-The function takes a page directory address, virtual address, physical address
-as an argument, and sets a page table entry. This function will walk the page
-directory to see if there is an existing mapping for a virtual address. If the
-virtual address is not present, then a new entry will be added
+Starts recording every virtual page translate() and the accesses through
+put_value(), get_value() and the rest look up, from every thread, to the
+file at path. Each thread appends to a ring of its own without locking,
+and a flush thread, started on the first call, writes the rings out in
+blocks. The file starts with the magic "VMACCES1", then the page size
+and a zero as 32-bit words; each block is a 32-bit thread number and
+entry count, then that many 64-bit entries of the page number shifted
+left by one, plus one for a write. benchmark/tlb_sim replays the file.
+Returns 0, or -1 when a trace is already running or path cannot be
+created.
 */
-int page_map(pde_t pgdir, unsigned long va, pte_t pa)
+int t_trace_start(const char *path)
 {
-    /*HINT: Similar to translate(), find the page directory (1st level)
-    and page table (2nd-level) indices. If no mapping exists, set the
-    virtual to physical mapping */
-
-    pde_t directory_entry = va >> page_tbl_off;     // The directory entry 0 + entry
-    pte_t table_entry = va & ((1 << page_off) - 1); // table entry mem[d_entry + entry] + tbl_off
-
-    // page table has not been set yet
-    if (physical_memory[directory_start + directory_entry * sizeof(pde_t)] == -1)
+    lock_mutex(&trace_lock);
+    if (trace_file != NULL)
+    {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
     {
-        pde_t page_idx = get_next_page(); // for the page table
-        memcpy(&physical_memory[directory_start + directory_entry * sizeof(pde_t)], &page_idx, sizeof(pde_t));
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    uint32_t header[2] = {PGSIZE, 0};
+    fwrite("VMACCES1", 8, 1, out);
+    fwrite(header, sizeof(header), 1, out);
 
-        // set all the page values to -1
-        for (int i = 0; i < PGSIZE; i++)
+    // drop whatever a thread still added after the last trace stopped
+    flush_rings();
+    trace_file = out;
+    if (!trace_started)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, trace_worker, NULL) != 0)
         {
-            physical_memory[page_idx + i] = -1;
-            physical_bitmap[page_idx + i] = 1;
+            perror("Failed to start the trace thread");
+            exit(1);
         }
-        // after you add a new page table translation entry, also add a translation to the TLB by implementing add_TLB()
-        add_TLB((void *)va, (void *)page_idx);
+        trace_started = true;
     }
-
-    pte_t pg_tbl;
-    memcpy(&pg_tbl, &physical_memory[directory_start + directory_entry * sizeof(pde_t)], sizeof(pte_t));
-    memcpy(&physical_memory[pg_tbl + table_entry * sizeof(pte_t)], &pa, sizeof(pte_t));
+    __atomic_store_n(&trace_on, true, __ATOMIC_RELAXED);
+    pthread_cond_signal(&trace_wake);
+    pthread_mutex_unlock(&trace_lock);
     return 0;
 }
 
-/* Function responsible for allocating pages
-and used by the benchmark
-@Author - Advith
+/*
+Stops the trace t_trace_start() began, writes out what the rings still
+hold and closes the file. Accesses racing with the stop may be left out.
 */
-void *t_malloc(unsigned int num_bytes)
+void t_trace_stop()
 {
-    pthread_mutex_lock(&mutex);
-
-    /*
-     * HINT: If the physical memory is not yet initialized, then allocate and initialize.
-     */
-    if (physical_memory == NULL)
+    lock_mutex(&trace_lock);
+    __atomic_store_n(&trace_on, false, __ATOMIC_RELAXED);
+    if (trace_file != NULL)
     {
-        set_physical_mem();
+        flush_rings();
+        fclose(trace_file);
+        trace_file = NULL;
     }
+    pthread_mutex_unlock(&trace_lock);
+}
 
-    /*
-     * HINT: If the page directory is not initialized, then initialize the
-     * page directory.
-     */
-
-    if (physical_bitmap[0] == 0)
+// Writes n to the recording as an LEB128 number
+static void record_number(unsigned long n)
+{
+    do
     {
-        // Page directory has not been initialized first page is for the directory
-        directory_start = (pde_t)0; // page table starts at address 0 of the memory
+        fputc((n & 0x7f) | (n >= 0x80 ? 0x80 : 0), record_file);
+        n >>= 7;
+    } while (n != 0);
+}
 
-        // set all the directory values to -1
-        for (int i = 0; i < PGSIZE; i++)
+// Index of the first recorded allocation starting above va
+static unsigned long recorded_above(unsigned long va)
+{
+    unsigned long low = 0;
+    unsigned long high = record_count;
+    while (low < high)
+    {
+        unsigned long mid = (low + high) / 2;
+        if (record_live[mid].va <= va)
         {
-            physical_memory[directory_start + i] = -1;
-            physical_bitmap[directory_start + i] = 1;
+            low = mid + 1;
         }
-    }
-
-    /* Next, using get_next_avail(), check if there are free pages. If
-     * free pages are available, set the bitmaps and map a new page. Note, you will
-     * have to mark which physical pages are used.
-     */
-    int pages_needed = (num_bytes / PGSIZE) + 1;
-    unsigned long virtual_address = get_next_avail(pages_needed);
-
-    for (int i = 0; i < pages_needed; i++)
-    {
-        unsigned long curr_add = virtual_address + i;
-        virtual_bitmap[curr_add] = 1;
-    }
-
-    for (int i = 0; i < pages_needed; i++)
-    {
-        unsigned long curr_add = virtual_address + i; // next pages are just increments
-
-        pte_t val_idx = get_next_page();
-        for (int j = 0; j < PGSIZE; j++)
+        else
         {
-            physical_bitmap[val_idx] = 1;
-            physical_memory[val_idx + j] = -1;
+            high = mid;
         }
-        page_map(directory_start, curr_add, val_idx);
     }
-    pthread_mutex_unlock(&mutex);
-    return (void *)(virtual_address << page_off);
+    return low;
 }
 
-/* The function copies data pointed by "val" to physical
- * memory pages using virtual address (va)
- * The function returns 0 if the put is successfull and -1 otherwise.
- * @Author - Advith
- */
-int put_value(void *va, void *val, int size)
+/*
+Index of the recorded allocation holding va, or -1 when recording is off,
+va is in another address space or no recorded allocation holds it. The
+caller holds record_lock.
+*/
+static long find_recorded(void *va)
 {
-    pthread_mutex_lock(&mutex);
-
-    /* HINT: Using the virtual address and translate(), find the physical page. Copy
-     * the contents of "val" to a physical page. NOTE: The "size" value can be larger
-     * than one page. Therefore, you may have to find multiple pages using translate()
-     * function.
-     */
-
-    // Check if the virtual address is valid
-    if (va == NULL)
+    if (record_file == NULL || current_space() != record_space)
     {
-        return -1; // Invalid virtual address
+        return -1;
     }
+    unsigned long i = recorded_above((unsigned long)va);
+    return i > 0 && (unsigned long)va - record_live[i - 1].va < record_live[i - 1].size ? (long)i - 1 : -1;
+}
 
-    // Calculate the number of pages needed to store the data
-    int pages_needed = (size / PGSIZE) + 1;
-
-    // Loop through each page
-    for (int i = 0; i < pages_needed; i++)
+// Adds the allocation of size bytes at va with id to the live ones
+static void record_insert(void *va, unsigned long size, unsigned long id)
+{
+    if (record_count == record_capacity)
     {
-        // Use translate() to find the physical page corresponding to the virtual address
-        pte_t pt_index = translate(directory_start, va + i);
-        if (pt_index == -1)
+        record_capacity = record_capacity == 0 ? 1024 : 2 * record_capacity;
+        record_live = realloc(record_live, record_capacity * sizeof(struct recorded));
+        if (record_live == NULL)
         {
-            perror("Invalid virtual address");
+            perror("Failed to allocate the recorded allocations");
             exit(1);
         }
-
-        // Copy data from the source buffer to the physical page
-        if (size < PGSIZE)
-        {
-            memcpy((int *)(&physical_memory[pt_index]), val, size);
-        }
-        else
-        {
-            memcpy((int *)(&physical_memory[pt_index]), val, PGSIZE);
-            size -= PGSIZE;
-        }
     }
-    pthread_mutex_unlock(&mutex);
-    return 0; // Successful data copy
+    unsigned long i = recorded_above((unsigned long)va);
+    memmove(&record_live[i + 1], &record_live[i], (record_count - i) * sizeof(struct recorded));
+    record_live[i] = (struct recorded){(unsigned long)va, size, id};
+    record_count++;
 }
 
-/*Given a virtual address, this function copies the contents of the page to val
-@Author - Advith*/
-void get_value(void *va, void *val, int size)
+// Drops live allocation i, returning its id
+static unsigned long record_remove(long i)
 {
-    pthread_mutex_lock(&mutex);
-    /* HINT: put the values pointed to by "va" inside the physical memory at given
-     * "val" address. Assume you can access "val" directly by derefencing them.
-     */
+    unsigned long id = record_live[i].id;
+    record_count--;
+    memmove(&record_live[i], &record_live[i + 1], (record_count - i) * sizeof(struct recorded));
+    return id;
+}
 
-    // Check if the virtual address is valid
-    if (va == NULL)
+// Records t_malloc() handing out size bytes at va, under an id freed before if there is one
+static void record_malloc(void *va, unsigned long size)
+{
+    lock_mutex(&record_lock);
+    if (record_file != NULL && va != NULL && current_space() == record_space)
     {
-        perror("Invalid virtual address");
-        exit(1);
+        unsigned long id = record_free_count > 0 ? record_free_ids[--record_free_count] : record_next_id++;
+        record_insert(va, size, id);
+        fputc(RECORD_MALLOC, record_file);
+        record_number(id);
+        record_number(size);
     }
+    pthread_mutex_unlock(&record_lock);
+}
 
-    // Calculate the number of pages needed to store the data
-    int pages = (size / PGSIZE) + 1;
-
-    // Loop through each page
-    for (int i = 0; i < pages; i++)
+// Records t_free() of the allocation starting at va; frees of parts are left out
+static void record_free(void *va)
+{
+    lock_mutex(&record_lock);
+    long i = find_recorded(va);
+    if (i >= 0 && record_live[i].va == (unsigned long)va)
     {
-        // Use translate() to find the physical page corresponding to the virtual address
-        pte_t pt_index = translate(directory_start, va + i);
-        if (pt_index == -1)
-        {
-            perror("Invalid virtual address");
-            exit(1);
-        }
-
-        // Copy data from the physical page to the source buffer
-        if (size < PGSIZE)
-        {
-            memcpy(val, (int *)&physical_memory[pt_index], size);
-        }
-        else
+        if (record_free_count == record_free_capacity)
         {
-            memcpy(val, (int *)&physical_memory[pt_index], PGSIZE);
-            size -= PGSIZE;
+            record_free_capacity = record_free_capacity == 0 ? 1024 : 2 * record_free_capacity;
+            record_free_ids = realloc(record_free_ids, record_free_capacity * sizeof(unsigned long));
+            if (record_free_ids == NULL)
+            {
+                perror("Failed to allocate the recorded ids");
+                exit(1);
+            }
         }
+        unsigned long id = record_remove(i);
+        record_free_ids[record_free_count++] = id;
+        fputc(RECORD_FREE, record_file);
+        record_number(id);
     }
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&record_lock);
 }
 
-/* Responsible for releasing one or more memory pages using virtual address (va)
-@Author - Advith
-*/
-void t_free(void *va, int size)
+// Records a put_value() or get_value() of len bytes at va that one recorded allocation holds
+static void record_copy(int op, void *va, unsigned long len)
 {
-    pthread_mutex_lock(&mutex);
-    /* Part 1: Free the page table entries starting from this virtual address
-     * (va). Also mark the pages free in the bitmap. Perform free only if the
-     * memory from "va" to va+size is valid.
-     *
-     * Part 2: Also, remove the translation from the TLB
-     */
-    unsigned long curr_add = (unsigned long)va;
-
-    pde_t va_bitmap_add = (int)((curr_add >> page_off));
-
-    pte_t pa = translate(directory_start, va);
-
-    for (int i = 0; i < size; i++)
+    lock_mutex(&record_lock);
+    long i = find_recorded(va);
+    unsigned long offset = i >= 0 ? (unsigned long)va - record_live[i].va : 0;
+    if (i >= 0 && len <= record_live[i].size - offset)
     {
-        if (physical_bitmap[pa + 1] != -1)
-        {
-            physical_bitmap[pa + 1] = 0;
-            physical_memory[pa + 1] = -1;
-        }
+        fputc(op, record_file);
+        record_number(record_live[i].id);
+        record_number(offset);
+        record_number(len);
     }
-    virtual_bitmap[va_bitmap_add] = 0;
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&record_lock);
 }
 
 /*
-This function receives two matrices mat1 and mat2 as an argument with size
-argument representing the number of rows and columns. After performing matrix
-multiplication, copy the result to answer.
+Records t_realloc() of the allocation at va to size bytes now at moved.
+The trace has no resize, so it shows as a free and a new allocation of
+the same id.
 */
-void mat_mult(void *mat1, void *mat2, int size, void *answer)
+static void record_resize(void *va, void *moved, unsigned long size)
 {
-
-    /* Hint: You will index as [i * size + j] where  "i, j" are the indices of the
-     * matrix accessed. Similar to the code in test.c, you will use get_value() to
-     * load each element and perform multiplication. Take a look at test.c! In addition to
-     * getting the values from two matrices, you will perform multiplication and
-     * store the result to the "answer array"
-     */
-    int x, y, val_size = sizeof(int);
-    int i, j, k;
-    for (i = 0; i < size; i++)
+    if (va == NULL)
     {
-        for (j = 0; j < size; j++)
-        {
-            unsigned int a, b, c = 0;
-            for (k = 0; k < size; k++)
-            {
-                int address_a = (unsigned int)mat1 + ((i * size * sizeof(int))) + (k * sizeof(int));
-                int address_b = (unsigned int)mat2 + ((k * size * sizeof(int))) + (j * sizeof(int));
-                get_value((void *)address_a, &a, sizeof(int));
-                get_value((void *)address_b, &b, sizeof(int));
-                // printf("Values at the index: %d, %d, %d, %d, %d\n",
-                //     a, b, size, (i * size + k), (k * size + j));
-                c += (a * b);
-            }
-            int address_c = (unsigned int)answer + ((i * size * sizeof(int))) + (j * sizeof(int));
-            // printf("This is the c: %d, address: %x!\n", c, address_c);
-            put_value((void *)address_c, (void *)&c, sizeof(int));
-        }
+        record_malloc(moved, size);
+        return;
+    }
+    if (size == 0)
+    {
+        record_free(va);
+        return;
     }
+    lock_mutex(&record_lock);
+    long i = find_recorded(va);
+    if (i >= 0 && record_live[i].va == (unsigned long)va)
+    {
+        unsigned long id = record_remove(i);
+        record_insert(moved, size, id);
+        fputc(RECORD_FREE, record_file);
+        record_number(id);
+        fputc(RECORD_MALLOC, record_file);
+        record_number(id);
+        record_number(size);
+    }
+    pthread_mutex_unlock(&record_lock);
 }
 
 /*
- * Part 2: Add a virtual to physical page translation to the TLB.
- * Feel free to extend the function arguments or return type.
- * @Author - Taj
- */
-int add_TLB(void *va, void *pa)
+Starts recording the t_malloc(), t_free(), t_realloc(), put_value() and
+get_value() calls of every thread in the caller's address space to the
+file at path, in the format benchmark/bench_suite replays: the magic
+"VMTRACE1", then per call an op byte and LEB128 numbers. A malloc is
+RECORD_MALLOC id size, a free RECORD_FREE id, and a put or get
+RECORD_PUT or RECORD_GET id offset length. An id names a live allocation
+and is handed out again once it is freed, so ids stay below the most
+allocations live at once. Allocations made before the start, and copies
+that do not fit in one allocation, are left out. Calls are written in
+the order they take record_lock, so recording serializes them. Returns
+0, or -1 when a recording is already running or path cannot be created.
+*/
+int t_record_start(const char *path)
 {
-
-    /*Part 2 HINT: Add a virtual to physical page translation to the TLB */
-    int entry = (unsigned long)va % TLB_ENTRIES;
-
-    tlb_entries[entry].virtual_page = (unsigned long)va;
-    tlb_entries[entry].physical_page = (unsigned long)pa;
-    tlb_entries[entry].valid = true;
-    return 1;
+    lock_mutex(&record_lock);
+    FILE *out = record_file == NULL ? fopen(path, "wb") : NULL;
+    if (out == NULL)
+    {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    fwrite(RECORD_MAGIC, strlen(RECORD_MAGIC), 1, out);
+    record_file = out;
+    record_space = current_space();
+    __atomic_store_n(&record_on, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&record_lock);
+    return 0;
 }
 
-/*
- * Part 2: Check TLB for a valid translation.
- * Returns the physical page address.
- * Feel free to extend this function and change the return type.
- * @Author - Taj
- */
-pte_t *check_TLB(void *va)
+// Stops the recording t_record_start() began and closes the file
+void t_record_stop()
 {
-
-    /* Part 2: TLB lookup code here */
-    int entry = (unsigned long)va % TLB_ENTRIES;
-
-    if (tlb_entries[entry].valid && (tlb_entries[entry].virtual_page == (unsigned long)va))
+    lock_mutex(&record_lock);
+    __atomic_store_n(&record_on, false, __ATOMIC_RELAXED);
+    if (record_file != NULL)
     {
-        pte_t foundTable = tlb_entries[entry].physical_page; // return the physical page address
-        return (pte_t *)foundTable;
+        fclose(record_file);
+        record_file = NULL;
     }
-
-    /*This function should return a pte_t pointer*/
-    return NULL;
+    record_count = 0;
+    record_free_count = 0;
+    record_next_id = 0;
+    pthread_mutex_unlock(&record_lock);
 }
-
-/*
- * Part 2: Print TLB miss rate.
- * Feel free to extend the function arguments or return type.
- * @Author - Taj
- */
-void print_TLB_missrate()
-{
-    /*Part 2 Code here to calculate and print the TLB miss rate*/
-    double miss_rate = 0;
-    miss_rate = TLB_misses / (TLB_hits + TLB_misses);
-    fprintf(stderr, "hits: %lf \n", TLB_hits);
-    fprintf(stderr, "misses: %lf \n", TLB_misses);
-    fprintf(stderr, "TLB miss rate %lf \n", miss_rate);
-}
\ No newline at end of file
@@ -5,20 +5,157 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
 
-//Assume the address space is 32 bits, so the max memory size is 4GB
-//Page size is 4KB
+//The address space is 48 bits with a 4-level page table, or 32 bits (4GB)
+//with the original 2-level one. Page size is 4KB by default
 
 //Add any important includes here which you may need
 
+// Page size, a power of two of at least 4K; override with -DPGSIZE=...
+// when building the library and the programs using it
+#ifndef PGSIZE
 #define PGSIZE 4096
+#endif
+#define PGSHIFT __builtin_ctzll(PGSIZE)
+
+// Page table levels, 2 to 4; override with -DPT_LEVELS=... like PGSIZE
+#ifndef PT_LEVELS
+#define PT_LEVELS 4
+#endif
 
-// Maximum size of virtual memory
+// Maximum size of virtual memory: 4GB for two levels, and a full page table
+// of 8 byte entries per level above that (48 bits for four levels of 4K)
+#ifndef MAX_MEMSIZE
+#if PT_LEVELS == 2
 #define MAX_MEMSIZE 4ULL*1024*1024*1024
+#else
+#define MAX_MEMSIZE (1ULL << (PGSHIFT + PT_LEVELS * (PGSHIFT - 3)))
+#endif
+#endif
 
 // Size of "physcial memory"
 #define MEMSIZE 1024*1024*1024
 #define TLB_ENTRIES 512
+#define TLB_DEFAULT_WAYS 4
+
+// Address spaces live at once, the initial one included
+#define MAX_SPACES 64
+
+// Largest request served from shared slab pages instead of whole pages
+#ifndef SLAB_MAX_SIZE
+#define SLAB_MAX_SIZE (PGSIZE / 4)
+#endif
+
+// TLB replacement policies for set_TLB_config()
+enum tlb_policy
+{
+    TLB_LRU,    // exact least recently used
+    TLB_PLRU,   // tree pseudo-LRU
+    TLB_CLOCK,  // second chance per set
+    TLB_RANDOM, // xorshift random way
+};
+
+// Policies for choosing the page to swap out, for set_paging_config()
+enum evict_policy
+{
+    EVICT_CLOCK,      // second chance over all frames
+    EVICT_LRU_APPROX, // aging counters fed by the accessed bits
+    EVICT_2Q,         // probation FIFO in front of a second chance main queue
+};
+
+// Demand paging counters filled in by get_paging_stats()
+struct paging_stats
+{
+    unsigned long faults;     // pages brought back in from swap on access
+    unsigned long prefetched; // pages read back ahead of access
+    unsigned long evictions;  // pages pushed out of memory
+    unsigned long writebacks; // evictions that had to write the page out
+    unsigned long stall_ns;   // time accesses spent waiting for pages to come in
+    unsigned long resident;   // frames in use right now
+};
+
+// Orders of free frame blocks get_frame_stats() counts, 2^0 to 2^9 frames
+#define VM_FRAME_ORDERS 10
+
+// Free physical memory layout filled in by get_frame_stats()
+struct frame_stats
+{
+    unsigned long free_frames;
+    unsigned long free_runs;                    // runs of consecutive free frames
+    unsigned long largest_free_run;             // frames in the longest of them
+    unsigned long free_blocks[VM_FRAME_ORDERS]; // free aligned blocks of 2^order frames, by order
+};
+
+// Page sharing counters filled in by get_merge_stats()
+struct merge_stats
+{
+    unsigned long zero_pages;   // pages reading from the shared zero page
+    unsigned long frames_saved; // frames the pages sharing one would take on their own
+    unsigned long merged;       // pages the scanner merged into an identical frame
+    unsigned long scanned;      // pages the scanner hashed
+    unsigned long scan_ns;      // CPU time the scanner used
+};
+
+// Operations t_vm_stats() keeps latency histograms for
+enum vm_op
+{
+    VM_OP_MALLOC,    // t_malloc()
+    VM_OP_FREE,      // t_free()
+    VM_OP_PUT,       // put_value()
+    VM_OP_GET,       // get_value()
+    VM_OP_TRANSLATE, // translate()
+    VM_OPS,
+};
+
+// Latency histogram buckets: one per nanosecond below VM_HIST_SUB, then
+// VM_HIST_SUB per power of two, so a bucket spans at most 1/VM_HIST_SUB of
+// its values, up to 2^43 ns
+#define VM_HIST_SUB 16
+#define VM_HIST_BUCKETS (VM_HIST_SUB * 40)
+
+// Calls of an operation per thread for each one timed; override with
+// -DVM_STATS_SAMPLE=... when building the library
+#ifndef VM_STATS_SAMPLE
+#define VM_STATS_SAMPLE 64
+#endif
+
+// Latencies of one operation, timed for one call in VM_STATS_SAMPLE
+struct vm_histogram
+{
+    unsigned long count;  // calls timed
+    unsigned long sum_ns; // their total latency
+    unsigned long max_ns;
+    unsigned long buckets[VM_HIST_BUCKETS];
+};
+
+// Counters filled in by t_vm_stats(), summed over all threads since
+// startup. Building the library with -DVM_NO_STATS compiles the counting
+// out, and they all stay zero.
+struct vm_stats
+{
+    unsigned long tlb_hits;
+    unsigned long tlb_misses;
+    unsigned long page_walks;       // TLB misses the walk cache missed too, walked from the directory
+    unsigned long frames_allocated; // frames taken from the free bitmap
+    unsigned long frames_freed;     // frames given back to it
+    unsigned long tables_allocated; // page table and directory pages
+    unsigned long tables_freed;
+    unsigned long table_pages;      // page table and directory pages in use
+    unsigned long lock_waits;       // mutex acquisitions that had to block
+    unsigned long lock_wait_ns;     // time spent blocked in them
+    unsigned long calls[VM_OPS];
+    struct vm_histogram latency[VM_OPS];
+};
+
+// One part of a vectored transfer for t_readv()/t_writev(), or a pinned
+// span from t_pin() with buf pointing into physical memory
+struct t_iovec
+{
+    void *va;   // virtual address in the library's memory
+    void *buf;  // caller's buffer
+    size_t len; // bytes to copy
+};
 
 // Represents a page table entry
 typedef unsigned long pte_t;
@@ -33,15 +170,44 @@ typedef unsigned long pde_t;
 void set_physical_mem();
 pte_t translate(pde_t pgdir, void *va);
 int page_map(pde_t pgdir, unsigned long va, pte_t pa);
+long get_next_page();
+void free_page(long pa);
 
 pte_t *check_TLB(void *va);
 int add_TLB(void *va, void *pa);
+void remove_TLB(void *va);
+int set_TLB_config(unsigned int entries, unsigned int ways, enum tlb_policy policy);
+void set_walk_cache(bool enabled);
 
 void *t_malloc(unsigned int num_bytes);
+void set_large_pages(bool enabled);
 void t_free(void *va, int size);
+void *t_realloc(void *va, unsigned int old_size, unsigned int new_size);
 int put_value(void *va, void *val, int size);
 void get_value(void *va, void *val, int size);
+int t_writev(const struct t_iovec *iov, int count);
+int t_readv(const struct t_iovec *iov, int count);
+int t_pin(void *va, size_t len, struct t_iovec *spans, int max_spans);
+void t_unpin(const struct t_iovec *spans, int count);
 void mat_mult(void *mat1, void *mat2, int size, void *answer);
+int set_mat_threads(int threads);
+int set_paging_config(unsigned long max_resident, enum evict_policy policy, const char *swap_path);
+void get_paging_stats(struct paging_stats *stats);
+void get_frame_stats(struct frame_stats *stats);
+void set_prefetch(bool enabled);
+void set_merge_config(unsigned int pages_per_round, unsigned int interval_ms);
+void get_merge_stats(struct merge_stats *stats);
+int t_clone();
+int t_switch(int space);
+int t_destroy(int space);
 void print_TLB_missrate();
+void t_vm_stats(struct vm_stats *stats);
+unsigned long t_vm_percentile(const struct vm_histogram *hist, double percentile);
+void t_vm_stats_json(FILE *out);
+int t_vm_stats_dump(const char *path, unsigned int interval_ms);
+int t_trace_start(const char *path);
+void t_trace_stop();
+int t_record_start(const char *path);
+void t_record_stop();
 
 #endif